@@ -0,0 +1,110 @@
+/*
+	Affinity benchmark: jitter of the control loop with the tasks floating
+	over the CPUs, then pinned by pin_tasks() (CONTROL alone on one CPU).
+	Runs the perception, trajectory, control and raceline tasks on
+	track/cones.yaml with the pursuit controller, for the same time each.
+
+	Latency is start - release of each control job (release jitter), exec its
+	CPU time (cache and migration effects). Pinning needs 2 CPUs or more to
+	separate CONTROL from the other tasks.
+
+	Usage: ./bench/affinity_bench [seconds] [cpus, e.g. 2-3]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <allegro.h>
+
+#include "globals.h"
+#include "perception.h"
+#include "utilities.h"
+#include "tasks.h"
+#include "controller.h"
+#include "headless.h"
+#include "sim_context.h"
+#include "ptask.h"
+#include "bench.h"
+
+// "0-3,6" to a CPU set, restricted to the CPUs of the process; returns their number, 0 if invalid
+static int parse_cpus(const char *text, cpu_set_t *cpus)
+{
+	int first, last, length;
+	cpu_set_t allowed;
+
+	CPU_ZERO(cpus);
+	while (sscanf(text, "%d%n", &first, &length) == 1)
+	{
+		text += length;
+		last = first;
+		if (*text == '-' && sscanf(text + 1, "%d%n", &last, &length) == 1)
+			text += 1 + length;
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, cpus);
+		if (*text != ',') break;
+		text++;
+	}
+	if (*text != '\0') return 0;
+
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	CPU_AND(cpus, cpus, &allowed);
+	return CPU_COUNT(cpus);
+}
+
+static void run(const char *mode, const cpu_set_t *cpus, double seconds)
+{
+	struct timespec duration = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+	task_stats s;
+
+	bench_reset();
+
+	ptask_init(SCHED_OTHER);
+	connect_tasks();
+	if (cpus != NULL) pin_tasks(cpus);
+
+	task_create(PERCEPTION_TASK, perception_task, PERCEPTION_PERIOD, PERCEPTION_DEADLINE, PERCEPTION_PRIORITY, ACT);
+	task_create(TRAJECTORY_TASK, trajectory_task, TRAJECTORY_PERIOD, TRAJECTORY_DEADLINE, TRAJECTORY_PRIORITY, DEACT);
+	task_create_us(CONTROL_TASK, control_task, CONTROL_PERIOD_US, CONTROL_DEADLINE_US, CONTROL_PRIORITY, ACT);
+	task_create(RACELINE_TASK, raceline_task, RACELINE_PERIOD, RACELINE_DEADLINE, RACELINE_PRIORITY, ACT);
+	ptask_start();
+
+	nanosleep(&duration, NULL);
+	key[KEY_ESC] = 1;
+	for (int task = PERCEPTION_TASK; task < N_SIM_TASKS; task++)
+		if (task != DISPLAY_TASK) wait_for_task_end(task);
+
+	task_get_stats(CONTROL_TASK, &s);
+	const ptask_metric *latency = &s.metric[PTASK_LATENCY];
+	const ptask_metric *exec = &s.metric[PTASK_EXEC];
+	printf("%s,%lu,%lu,%.1f,%.1f,%.1f,%.1f,%.1f\n", mode, s.jobs, s.dmiss,
+		(double)latency->sum / latency->count * 1e-3,
+		ptask_metric_percentile(latency, 99.0) * 1e-3, latency->max * 1e-3,
+		ptask_metric_percentile(exec, 99.0) * 1e-3, exec->max * 1e-3);
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = (argc > 1) ? atof(argv[1]) : 10.0;
+	cpu_set_t cpus;
+
+	if (argc > 2) {
+		if (parse_cpus(argv[2], &cpus) == 0) {
+			fprintf(stderr, "No usable CPU in '%s'\n", argv[2]);
+			return 1;
+		}
+	}
+	else if (ptask_isolated_cpus(&cpus) == 0)
+		sched_getaffinity(0, sizeof(cpus), &cpus);
+
+	bench_init_track();
+	controller_select("pursuit");
+
+	printf("Control loop at %d us, %.1f s per mode, pinned on %d of %ld CPUs\n",
+		CONTROL_PERIOD_US, seconds, CPU_COUNT(&cpus), sysconf(_SC_NPROCESSORS_ONLN));
+	printf("mode,jobs,dmiss,latency_mean_us,latency_p99_us,latency_max_us,exec_p99_us,exec_max_us\n");
+	run("floating", NULL, seconds);
+	run("pinned", &cpus, seconds);
+	return 0;
+}
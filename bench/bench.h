@@ -0,0 +1,52 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+	Setup shared by the benchmarks that run the task pipeline, as the
+	headless mode does: track bitmap for the lidar, start pose and a clean
+	pipeline for every mode. Header only: the Makefile builds each bench source
+	as its own program.
+*/
+#include <allegro.h>
+
+#include "globals.h"
+#include "perception.h"
+#include "utilities.h"
+#include "headless.h"
+#include "sim_context.h"
+
+// Allegro in memory only and the track bitmap read by the lidar, from track/cones.yaml
+static void bench_init_track(void)
+{
+	cone cones[MAX_CONES_MAP];
+
+	allegro_init();
+	set_color_depth(32);
+	yellow = makecol(254, 221, 0);
+	blue = makecol(46, 103, 248);
+
+	track = create_bitmap(X_MAX, Y_MAX);
+	clear_to_color(track, makecol(128, 126, 120));
+	init_cones(cones);
+	load_cones_positions("track/cones.yaml", cones, MAX_CONES_MAP);
+	for (int i = 0; i < MAX_CONES_MAP; i++)
+		if (cones[i].color != -1)
+			circlefill(track, cones[i].x, cones[i].y, cone_radius * px_per_meter, cones[i].color);
+}
+
+// Before each mode: so that modes compare on the same work, every one starts
+// from the headless start pose with an empty map and boundary graph, no
+// published plan, velocity cache or controller warm start left by the
+// previous one, and the car in autonomous mode
+static void bench_reset(void)
+{
+	sim_context_init(&default_context);
+	sim_modules_reset();
+	car_x = HEADLESS_START_X;
+	car_y = HEADLESS_START_Y;
+	car_angle = HEADLESS_START_ANGLE;
+	key[KEY_ESC] = 0;
+	key[KEY_A] = 1;
+}
+
+#endif // BENCH_H
@@ -0,0 +1,107 @@
+/*
+	Cyclic executive benchmark: the control loop as a preemptive thread,
+	then run inline by the cyclic executive in its 1 ms frames, on the same
+	CPU for the same time. Perception, trajectory and raceline stay threads
+	in both modes: their jobs are longer than the frame.
+	Runs on track/cones.yaml with the pursuit controller.
+
+	For each mode and task: jobs, deadline misses, release latency (start -
+	release, the jitter), CPU time per job; then the CPU time of the process
+	per control job (overhead) and its context switches.
+
+	Usage: ./bench/cyclic_bench [seconds] [cpu]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <allegro.h>
+
+#include "globals.h"
+#include "perception.h"
+#include "utilities.h"
+#include "tasks.h"
+#include "controller.h"
+#include "headless.h"
+#include "sim_context.h"
+#include "ptask.h"
+#include "bench.h"
+
+static double cpu_seconds(const struct rusage *u)
+{
+	return u->ru_utime.tv_sec + u->ru_stime.tv_sec + (u->ru_utime.tv_usec + u->ru_stime.tv_usec) * 1e-6;
+}
+
+static void run(const char *mode, int cyclic, const cpu_set_t *cpu, double seconds)
+{
+	struct timespec duration = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+	struct rusage before, after;
+	task_stats s;
+
+	bench_reset();
+
+	ptask_init(SCHED_OTHER);
+	connect_tasks();
+	set_task_stacks();
+	pin_tasks(cpu);
+
+	getrusage(RUSAGE_SELF, &before);
+	if (cyclic) {
+		long frame_us = setup_cyclic_executive();
+		if (frame_us == 0) {
+			fprintf(stderr, "No valid cyclic executive table\n");
+			exit(EXIT_FAILURE);
+		}
+		task_create_us(EXECUTIVE_TASK, executive_task, frame_us, frame_us, EXECUTIVE_PRIORITY, ACT);
+	}
+	else
+		task_create_us(CONTROL_TASK, control_task, CONTROL_PERIOD_US, CONTROL_DEADLINE_US, CONTROL_PRIORITY, ACT);
+	task_create(PERCEPTION_TASK, perception_task, PERCEPTION_PERIOD, PERCEPTION_DEADLINE, PERCEPTION_PRIORITY, ACT);
+	task_create(TRAJECTORY_TASK, trajectory_task, TRAJECTORY_PERIOD, TRAJECTORY_DEADLINE, TRAJECTORY_PRIORITY, DEACT);
+	task_create(RACELINE_TASK, raceline_task, RACELINE_PERIOD, RACELINE_DEADLINE, RACELINE_PRIORITY, ACT);
+	ptask_start();
+
+	nanosleep(&duration, NULL);
+	key[KEY_ESC] = 1;
+	if (cyclic) wait_for_task_end(EXECUTIVE_TASK);
+	for (int task = PERCEPTION_TASK; task < N_SIM_TASKS; task++)
+		if (task != DISPLAY_TASK) wait_for_task_end(task);
+	getrusage(RUSAGE_SELF, &after);
+
+	for (int task = PERCEPTION_TASK; task <= CONTROL_TASK; task++)
+	{
+		task_get_stats(task, &s);
+		const ptask_metric *latency = &s.metric[PTASK_LATENCY];
+		const ptask_metric *exec = &s.metric[PTASK_EXEC];
+		printf("%s,%s,%lu,%lu,%.1f,%.1f,%.1f,%.1f\n", mode, task_names[task], s.jobs, s.dmiss,
+			(double)latency->sum / latency->count * 1e-3,
+			ptask_metric_percentile(latency, 99.0) * 1e-3, latency->max * 1e-3,
+			(double)exec->sum / exec->count * 1e-3);
+	}
+	task_get_stats(CONTROL_TASK, &s);
+	fprintf(stderr, "%s: %.1f us of CPU per control job, %ld context switches (%ld involuntary)\n", mode,
+		(cpu_seconds(&after) - cpu_seconds(&before)) * 1e6 / s.jobs,
+		(after.ru_nvcsw + after.ru_nivcsw) - (before.ru_nvcsw + before.ru_nivcsw),
+		after.ru_nivcsw - before.ru_nivcsw);
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = (argc > 1) ? atof(argv[1]) : 10.0;
+	int cpu = (argc > 2) ? atoi(argv[2]) : 0;
+	cpu_set_t one;
+
+	// Every task on the same CPU in both modes: the executive takes the place of the control thread
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+
+	bench_init_track();
+	controller_select("pursuit");
+
+	printf("Perception, trajectory and control on CPU %d, %.1f s per mode\n", cpu, seconds);
+	printf("mode,task,jobs,dmiss,latency_mean_us,latency_p99_us,latency_max_us,exec_mean_us\n");
+	run("threads", 0, &one, seconds);
+	run("cyclic", 1, &one, seconds);
+	return 0;
+}
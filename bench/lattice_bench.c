@@ -0,0 +1,84 @@
+/*
+	Lattice planner benchmark: candidates scored per second for an
+	increasing number of workers, on the full map of track/cones.yaml.
+
+	Usage: ./bench/lattice_bench [runs]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <allegro.h>
+
+#include "globals.h"
+#include "perception.h"
+#include "trajectory.h"
+#include "utilities.h"
+#include "lattice.h"
+#include "sim_context.h"
+
+int main(int argc, char **argv)
+{
+	int runs = (argc > 1) ? atoi(argv[1]) : 500;
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	allegro_init();
+	set_color_depth(32);
+	yellow = makecol(254, 221, 0);
+	blue = makecol(46, 103, 248);
+
+	// Full map, converted from pixels to meters
+	cone cones[MAX_CONES_MAP];
+	init_cones(cones);
+	load_cones_positions("track/cones.yaml", cones, MAX_CONES_MAP);
+
+	for (int i = 0; i < MAX_CONES_MAP; i++)
+	{
+		if (cones[i].color == yellow || cones[i].color == blue)
+		{
+			track_map[default_context.track_map_idx].x = cones[i].x / px_per_meter;
+			track_map[default_context.track_map_idx].y = cones[i].y / px_per_meter;
+			track_map[default_context.track_map_idx].color = cones[i].color;
+			default_context.track_map_idx++;
+		}
+	}
+
+	// Start on the centerline, heading to the next point (y axis pointing down)
+	waypoint centerline[2*MAX_DETECTED_CONES];
+	if (build_centerline(track_map, default_context.track_map_idx, centerline) < 2)
+	{
+		fprintf(stderr, "Not enough cones to build a centerline\n");
+		return 1;
+	}
+	float start_x = centerline[0].x;
+	float start_y = centerline[0].y;
+	float start_angle = atan2f(-(centerline[1].y - start_y), centerline[1].x - start_x) / deg2rad;
+
+	printf("%d cones, %d candidates per run, %d runs, %ld CPUs\n", default_context.track_map_idx, LATTICE_N_CANDIDATES, runs, n_cpus);
+	printf("workers,candidates_per_s,us_per_run\n");
+
+	for (int workers = 0; workers <= n_cpus && workers <= LATTICE_MAX_WORKERS; workers++)
+	{
+		lattice_stats_t before, after;
+
+		lattice_init(workers);
+		lattice_get_stats(&before);
+
+		for (int run = 0; run < runs; run++)
+			lattice_planning(&default_context, start_x, start_y, start_angle);
+
+		lattice_get_stats(&after);
+		lattice_shutdown();
+
+		long candidates = after.candidates - before.candidates;
+		long scoring_us = after.scoring_us - before.scoring_us;
+
+		// workers = 0 scores inline in the calling thread
+		printf("%d,%.0f,%.1f\n", workers,
+			scoring_us > 0 ? candidates * 1e6 / scoring_us : 0.0,
+			(double)scoring_us / runs);
+	}
+
+	allegro_exit();
+	return 0;
+}
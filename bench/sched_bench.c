@@ -0,0 +1,114 @@
+/*
+	Scheduling benchmark: the same synthetic task set on one CPU under
+	rate-monotonic fixed priorities (SCHED_FIFO) and under EDF (SCHED_DEADLINE).
+	Each job burns a fixed CPU time. The default set (non-harmonic periods,
+	86% utilization) is schedulable by EDF and not by RM: the task with the
+	longer period misses its deadlines under RM only. The runtimes must pass
+	the admission test of SCHED_DEADLINE: 95% of the CPU by default, minus
+	the 5% reserved for SCHED_OTHER by recent kernels.
+
+	Needs the privileges for real-time policies: without them ptask falls back
+	(reported in the policy column) and both runs are SCHED_OTHER.
+
+	The process is not pinned: SCHED_DEADLINE refuses tasks whose affinity is
+	smaller than their root domain (EPERM, then ptask falls back to RM). For
+	the tasks to compete, run it in an exclusive one-CPU cpuset, e.g. a cgroup
+	v2 partition: cpuset.cpus = 1 and cpuset.cpus.partition = root.
+
+	Usage: ./bench/sched_bench [seconds]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include "ptask.h"
+
+#define N_BENCH_TASKS		2
+#define RUNTIME_MARGIN_US	50
+
+static const long	period_us[N_BENCH_TASKS] = { 5000, 7000 };
+static const long	cost_us[N_BENCH_TASKS]   = { 2000, 3200 };
+
+static volatile int	stop;
+
+static long cpu_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return t.tv_sec * 1000000L + t.tv_nsec / 1000;
+}
+
+static void *busy_task(void *arg)
+{
+	int i = get_task_index(arg);
+	wait_for_activation(i);
+
+	while (!stop)
+	{
+		long end = cpu_us() + cost_us[i];
+		while (cpu_us() < end)
+			;
+		wait_for_period(i);
+	}
+	return NULL;
+}
+
+static void run(int policy, double seconds)
+{
+	struct timespec duration = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+
+	stop = 0;
+	ptask_init(policy);
+	for (int i = 0; i < N_BENCH_TASKS; i++)
+	{
+		// Runtime with a margin over the cost: EDF must not throttle a job of the set
+		task_set_runtime_us(i, cost_us[i] + RUNTIME_MARGIN_US);
+		task_create_us(i, busy_task, period_us[i], period_us[i], 0, ACT);
+	}
+	ptask_start();
+
+	for (int i = 0; i < N_BENCH_TASKS; i++)
+		if (task_policy(i) != policy)
+			fprintf(stderr, "%s: task %d runs under %s\n", ptask_policy_name(policy), i,
+				ptask_policy_name(task_policy(i)));
+
+	nanosleep(&duration, NULL);
+	stop = 1;
+	for (int i = 0; i < N_BENCH_TASKS; i++)
+		wait_for_task_end(i);
+
+	for (int i = 0; i < N_BENCH_TASKS; i++)
+	{
+		task_stats s;
+		task_get_stats(i, &s);
+		printf("%s,%s,%d,%ld,%ld,%lu,%lu,%.1f,%.1f\n",
+			policy == SCHED_DEADLINE ? "edf" : "rm", ptask_policy_name(task_policy(i)),
+			i, period_us[i], cost_us[i], s.jobs, s.dmiss,
+			ptask_metric_percentile(&s.metric[PTASK_RESPONSE], 99.0) * 1e-3,
+			s.metric[PTASK_RESPONSE].max * 1e-3);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = (argc > 1) ? atof(argv[1]) : 5.0;
+	double u = 0.0;
+	cpu_set_t cpus;
+	int n_cpus = 0;
+
+	// The schedulers only differ when the tasks compete for one CPU
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+		n_cpus = CPU_COUNT(&cpus);
+	if (n_cpus > 1)
+		fprintf(stderr, "warning: %d CPUs available, the tasks may not compete (run it in a one-CPU cpuset)\n", n_cpus);
+
+	for (int i = 0; i < N_BENCH_TASKS; i++)
+		u += (double)cost_us[i] / period_us[i];
+	printf("%d tasks on %d CPUs, utilization %.3f, %.1f s per scheduler\n", N_BENCH_TASKS, n_cpus, u, seconds);
+
+	printf("scheduler,policy,task,period_us,cost_us,jobs,dmiss,response_p99_us,response_max_us\n");
+	run(PTASK_SCHED_RM, seconds);
+	run(SCHED_DEADLINE, seconds);
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+	Vehicle model benchmark: vehicle-steps per second on one core, scalar
+	vehicle_step() against the SoA vehicle_batch_step(), and the deviation of
+	the batch from the scalar model over one simulated second.
+
+	Usage: ./bench/vehicle_bench [cars] [steps]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "globals.h"
+#include "vehicle.h"
+#include "vehicle_batch.h"
+
+static vehicle_batch	batch;
+static vehicle_state	scalar[VEHICLE_BATCH_MAX];
+static float			pedal[VEHICLE_BATCH_MAX], steering[VEHICLE_BATCH_MAX];
+
+static double now_s(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static float uniform(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+// Random cars (both branches of the pedal, kinematic and dynamic speeds)
+static void setup(int n)
+{
+	vehicle_state zero = {0};
+	vehicle_batch_init(&batch, n, &zero);
+
+	for (int i = 0; i < n; i++)
+	{
+		vehicle_state s = {0};
+		s.yaw = uniform(-M_PI, M_PI);
+		s.vx = uniform(0.0f, VEHICLE_MAX_SPEED);
+		scalar[i] = s;
+		vehicle_batch_set(&batch, i, &s);
+	}
+}
+
+static void random_inputs(int n)
+{
+	for (int i = 0; i < n; i++) {
+		pedal[i] = uniform(-1.0f, 1.0f);
+		steering[i] = uniform(-VEHICLE_MAX_STEERING, VEHICLE_MAX_STEERING);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int n = (argc > 1) ? atoi(argv[1]) : 1024;
+	int steps = (argc > 2) ? atoi(argv[2]) : 1000;
+	if (n < 1 || n > VEHICLE_BATCH_MAX) n = VEHICLE_BATCH_MAX;
+
+	srand(1);
+
+	// 1) Agreement with vehicle_step(), inputs changing every step
+	setup(n);
+	int check_steps = (int)(1.0f / VEHICLE_DT + 0.5f);
+	for (int k = 0; k < check_steps; k++)
+	{
+		random_inputs(n);
+		for (int i = 0; i < n; i++)
+			vehicle_step(&scalar[i], pedal[i], steering[i], VEHICLE_DT);
+		vehicle_batch_step(&batch, pedal, steering, VEHICLE_DT);
+	}
+
+	float max_pos = 0.0f, max_yaw = 0.0f;
+	for (int i = 0; i < n; i++)
+	{
+		vehicle_state s;
+		vehicle_batch_get(&batch, i, &s);
+		max_pos = fmaxf(max_pos, hypotf(s.x - scalar[i].x, s.y - scalar[i].y));
+		max_yaw = fmaxf(max_yaw, fabsf(s.yaw - scalar[i].yaw));
+	}
+	int ok = (max_pos <= VEHICLE_BATCH_TOLERANCE && max_yaw <= VEHICLE_BATCH_TOLERANCE);
+
+	printf("%d cars, %d steps of %.3f s (%d RK4 substeps), %d lanes\n",
+		n, steps, VEHICLE_DT, (int)ceilf(VEHICLE_DT * VEHICLE_RK4_RATE - 1e-3f), VEHICLE_BATCH_LANES);
+	printf("after 1 s: max position error %.2e m, max heading error %.2e rad (%s)\n",
+		max_pos, max_yaw, ok ? "ok" : "ABOVE TOLERANCE");
+
+	// 2) Throughput, fixed inputs
+	random_inputs(n);
+	printf("model,vehicle_steps_per_s,ns_per_vehicle_step\n");
+
+	setup(n);
+	double start = now_s();
+	for (int k = 0; k < steps; k++)
+		for (int i = 0; i < n; i++)
+			vehicle_step(&scalar[i], pedal[i], steering[i], VEHICLE_DT);
+	double scalar_s = now_s() - start;
+
+	start = now_s();
+	for (int k = 0; k < steps; k++)
+		vehicle_batch_step(&batch, pedal, steering, VEHICLE_DT);
+	double batch_s = now_s() - start;
+
+	double total = (double)n * steps;
+	printf("scalar,%.0f,%.1f\n", total / scalar_s, scalar_s * 1e9 / total);
+	printf("batch,%.0f,%.1f\n", total / batch_s, batch_s * 1e9 / total);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#ifndef BOUNDARIES_H
+#define BOUNDARIES_H
+
+#include "globals.h"
+#include "perception.h"
+#include "trajectory.h"
+
+#define BOUNDARY_LEFT	0	// blue cones
+#define BOUNDARY_RIGHT	1	// yellow cones
+
+#define MAX_BOUNDARY_POINTS		MAX_CONES_MAP
+#define BOUNDARY_LINK_RADIUS	0.6f	// max distance between consecutive cones of a boundary [m]
+#define BOUNDARY_MIN_LOOP		10		// smallest chain allowed to close on itself
+#define BOUNDARY_MIN_TURN_COS	-0.7f	// links turning by more than ~135 degrees fold back on the chain
+#define BOUNDARY_SPLICE_DETOUR	1.3f	// max (|uv| + |vw|) / |uw| to insert v into the link u-w
+#define BOUNDARY_MAX_WIDTH		2.0f	// left/right points farther than this are not paired [m]
+
+/* Neighbour search grid (cells of BOUNDARY_LINK_RADIUS, cones outside are clamped to the border) */
+#define BOUNDARY_GRID_COLS		40
+#define BOUNDARY_GRID_ROWS		26
+
+typedef struct {
+	int			version;							// publication counter (0 = nothing published)
+	int			n_points[2];
+	int			closed[2];
+	waypoint	points[2][MAX_BOUNDARY_POINTS];		// ordered in discovery (driving) direction
+
+	/* Left/right pairing of this version, filled by boundaries_centerline() */
+	int			paired_version;						// version of the pairs below (0 = none)
+	int			n_pairs;
+	waypoint	pair_center[MAX_BOUNDARY_POINTS], pair_left[MAX_BOUNDARY_POINTS], pair_right[MAX_BOUNDARY_POINTS];
+} track_boundaries;
+
+// Writer side (perception task): called by update_map() for every cone added to the map
+void	boundaries_add_cone(cone *track_map, int cone_idx);
+void	boundaries_publish();
+void	boundaries_reset();		// empty map (no task may be adding cones)
+
+// Reader side: copies the boundaries only if the map version changed, returns the version
+int		boundaries_get(track_boundaries *boundaries);
+
+// Midpoints of the left/right pairs (left/right outputs may be NULL), returns the number of points;
+// the pairs are computed once per version and kept in boundaries
+int		boundaries_centerline(track_boundaries *boundaries, waypoint *centerline,
+								waypoint *left, waypoint *right, int max_points);
+
+#endif // BOUNDARIES_H
@@ -5,11 +5,31 @@
 #include "globals.h"
 #include "perception.h"
 
-extern float 	steering; // in radians
-extern float	pedal; // [0 -> 1]
+/* Declared worst-case CPU time of one step (see controller.h) */
+#define KEYBOARD_BUDGET_US		50
+#define PP_BUDGET_US			100
 
+/* Pure pursuit */
+#define PP_LOOKAHEAD_MIN		0.4f	// lookahead distance at standstill [m]
+#define PP_LOOKAHEAD_GAIN		1.0f	// additional lookahead per unit of speed [s]
+#define PP_SEARCH_WINDOW		8		// waypoints searched ahead of the previous nearest one
+#define PP_SEARCH_BACK			2		// waypoints searched behind it
+#define PP_RELOCALIZE_DISTANCE	0.1f	// a new path that moved more than this under the hint is searched fully [m]
+#define PP_CLOSED_DISTANCE		0.5f	// paths whose ends are closer than this are followed as a loop [m]
 
-void keyboard_control(float *car_x, float *car_y, int *car_angle);
-void autonomous_control(float *car_x, float *car_y, int *car_angle, waypoint *trajectory);
+// PP_LOOKAHEAD_MIN, PP_LOOKAHEAD_GAIN unless changed with param_set()
+extern float	pp_lookahead_min, pp_lookahead_gain;
+
+/* Pure pursuit state of one pipeline: nearest waypoint of the last tick, valid for version */
+typedef struct {
+	int			idx;		// -1: search the whole path
+	int			version;
+	waypoint	point;
+} pursuit_state_t;
+
+
+// Set ctx->pedal and ctx->steering (the car is moved by controller_step())
+void keyboard_control(sim_context *ctx);
+void autonomous_control(sim_context *ctx, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path);
 
 #endif // CONTROL_H
\ No newline at end of file
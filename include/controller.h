@@ -0,0 +1,49 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <stdio.h>
+
+#include "globals.h"
+#include "trajectory.h"
+
+#define CONTROLLER_DEFAULT	"mpc"	// autonomous controller used when none is given on the command line
+
+/* Controller plug-in: one instance per controller, registered in controller.c */
+typedef struct {
+	const char	*name;
+	long		budget_us;		// declared worst-case CPU time of one step
+	void		(*init)(void);
+	// Sets ctx->pedal and ctx->steering from the pose; controller_step() then moves the car
+	void		(*step)(sim_context *ctx, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path);
+	void		(*reset)(sim_context *ctx);	// called when the controller takes over the car
+} controller_t;
+
+typedef struct {
+	long	steps;
+	long	overruns;			// steps above budget_us
+	long	cpu_sum_us;
+	long	cpu_max_us;
+} controller_stats_t;
+
+extern const controller_t keyboard_controller;
+extern const controller_t pursuit_controller;
+extern const controller_t mpc_controller;
+
+// Selects the autonomous controller by name (calls its init); returns 0 if unknown.
+// Also names the controllers in the trace (labels of TRACE_OVERRUN): call it before trace_start()
+int		controller_select(const char *name);
+void	controller_list(FILE *out);
+
+// Runs one step of the manual (keyboard) or of the autonomous controller, then vehicle_model().
+// The step alone is timed with CLOCK_THREAD_CPUTIME_ID against the declared budget; an
+// overrun is counted and traced (TRACE_OVERRUN in the trace of the calling task)
+void	controller_step(sim_context *ctx, int autonomous, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path);
+
+// Warm-up before the first job: one reset and step of the autonomous controller on ctx
+// (a warm-up copy, see sim_context.h), not counted in the statistics
+void	controller_warmup(sim_context *ctx, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path);
+
+void	controller_get_stats(const controller_t *controller, controller_stats_t *stats);
+void	controller_print_stats();
+
+#endif // CONTROLLER_H
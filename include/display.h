@@ -19,6 +19,10 @@ void draw_perception();
 
 void draw_trajectory(waypoint *trajectory);
 
+void draw_raceline();
+
+void draw_task_stats();
+
 void update_display();
 
 
@@ -7,27 +7,55 @@
 
 // #define DEBUG
 #define PROFILING
+// #define LATTICE_PLANNER	// local lattice planner instead of the centerline planner
+// #define JITTER_MEASUREMENT	// report the activation jitter of the control loop at exit (disable PROFILING)
 
 // ------------------------
 // 	TASKs COSTANTS
 // ------------------------
 /* Task periods (ms) */
 #define PERCEPTION_PERIOD    50
-#define TRAJECTORY_PERIOD    10
-#define CONTROL_PERIOD       10
+#define TRAJECTORY_PERIOD    PERCEPTION_PERIOD	// activated by each scan: minimum inter-arrival time
+#define CONTROL_PERIOD_US    1000	// in microseconds: the control loop runs at up to 1 kHz
 #define DISPLAY_PERIOD       17
+#define RACELINE_PERIOD     200
 
 /* Deadlines (ms) */
 #define PERCEPTION_DEADLINE		PERCEPTION_PERIOD
-#define TRAJECTORY_DEADLINE  	TRAJECTORY_PERIOD
-#define CONTROL_DEADLINE     	CONTROL_PERIOD
+#define TRAJECTORY_DEADLINE  	10		// from the end of the scan
+#define CONTROL_DEADLINE_US  	CONTROL_PERIOD_US
 #define DISPLAY_DEADLINE     	DISPLAY_PERIOD
+#define RACELINE_DEADLINE    	RACELINE_PERIOD
+
+/* Perception -> trajectory -> control: from the release of a scan to the first control job using its plan (us) */
+#define PIPELINE_E2E_DEADLINE_US	(PERCEPTION_PERIOD * 1000)
+
+/* CPU budgets per period under SCHED_DEADLINE (us), about 0.85 CPU in total */
+#define PERCEPTION_RUNTIME_US	5000
+#define TRAJECTORY_RUNTIME_US	8000
+#define CONTROL_RUNTIME_US		200
+#define DISPLAY_RUNTIME_US		5000
+#define RACELINE_RUNTIME_US		20000
+
+/* CPU budgets per period enforced by ptask (us): perception cuts its scan, raceline is demoted */
+#define PERCEPTION_BUDGET_US	10000
+#define RACELINE_BUDGET_US		RACELINE_RUNTIME_US
+
+/* Task stacks (bytes, mapping() alone uses ~280 KB: see the STACK_PEAK_KB rows) and heap prefaulted by --rt-start */
+#define PERCEPTION_STACK_SIZE	(1024 * 1024)
+#define TASK_STACK_SIZE			(256 * 1024)	// the other tasks use less than 32 KB
+#define RT_HEAP_PREFAULT		(8 * 1024 * 1024)
+
+/* Time kept free before the deadline by the anytime trajectory planner (us) */
+#define TRAJECTORY_SAFETY_MARGIN_US	2000
 
 /* Priorities (lower number = higher priority) */
 #define PERCEPTION_PRIORITY	15
 #define TRAJECTORY_PRIORITY	20
 #define CONTROL_PRIORITY	25
 #define DISPLAY_PRIORITY    30
+#define RACELINE_PRIORITY   35	// background optimizer, lowest priority
+#define EXECUTIVE_PRIORITY	CONTROL_PRIORITY	// --cyclic: runs the control job
 
 /* Drawing mutex */
 extern pthread_mutex_t draw_mutex;
@@ -80,8 +108,9 @@ typedef struct {
 	int		color;
 } pointcloud_t;
 
-extern pointcloud_t measures[MAX_DETECTED_CONES]; // array of detected cones
+extern pointcloud_t *const measures; // LiDAR scan of the default pipeline (see sim_context.h)
 
-extern sem_t lidar_sem; // semaphore to pass lidar data to mapping task
+/* State of one perception/planning/control pipeline, defined in sim_context.h */
+typedef struct sim_context sim_context;
 
 #endif // GLOBALS_H
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "globals.h"
+
+/*
+	Headless mode: no window, no keyboard, no threads. The jobs of the
+	perception, trajectory, control and raceline tasks are released in
+	order on a simulated clock that advances by CONTROL_PERIOD_US per control
+	job, as fast as the CPU allows. The car starts on the track and is
+	always driven by the autonomous controller.
+
+	Simulated time is task time, as in the real-time mode: one simulated
+	second moves the car by SIM_TIME_SCALE seconds of vehicle_model() time.
+	It is the ptask virtual clock, so the trajectory deadline never cuts the
+	planner and the same run always gives the same output.
+*/
+
+#define HEADLESS_MAX_SECONDS	600.0f	// limit of a run given in laps [simulated s]
+
+/* Default start pose, on the track of track/cones.yaml: left straight, heading up (blue cones on the left) */
+#define HEADLESS_START_X		2.85f	// [m]
+#define HEADLESS_START_Y		3.60f	// [m]
+#define HEADLESS_START_ANGLE	104		// [deg]
+
+/* Lap gate: the line through the start pose, across the start heading */
+#define LAP_GATE_HALF_WIDTH		1.0f	// [m]
+#define LAP_MIN_DISTANCE		5.0f	// distance driven before the gate counts again [m]
+
+// Stage periods, PERCEPTION_PERIOD, ... unless changed with param_set() [ms].
+// The control period is fixed: it sets the vehicle integration step. The
+// trajectory stage runs after each scan, within headless_trajectory_deadline.
+extern int	headless_perception_period, headless_trajectory_deadline, headless_raceline_period;
+
+// Runs from the start pose until laps laps are completed (0 = no limit) or
+// seconds of simulated time have elapsed (0 = HEADLESS_MAX_SECONDS), then
+// writes lap times and per-stage CPU time and deadline misses (CPU time
+// above the period) to output (profiler row format). Returns the completed laps, -1 on error.
+int		headless_run(int laps, float seconds, float start_x, float start_y, int start_angle, const char *output);
+
+#endif // HEADLESS_H
@@ -0,0 +1,45 @@
+#ifndef LATTICE_H
+#define LATTICE_H
+
+#include "globals.h"
+#include "perception.h"
+#include "trajectory.h"
+
+/* Lattice: LATTICE_N_CURVATURES end curvatures x LATTICE_N_LENGTHS lengths */
+#define LATTICE_N_CURVATURES	25
+#define LATTICE_N_LENGTHS		4
+#define LATTICE_N_CANDIDATES	(LATTICE_N_CURVATURES * LATTICE_N_LENGTHS)
+#define LATTICE_MAX_CURVATURE	3.0f	// [1/m]
+#define LATTICE_LENGTH_STEP		0.5f	// candidate lengths are 1..N_LENGTHS steps [m]
+#define LATTICE_POINTS			20		// samples per candidate (also the published waypoints)
+
+#define LATTICE_MAX_WORKERS		16
+#define LATTICE_WORKERS			4
+
+/* Scoring */
+#define LATTICE_MIN_CLEARANCE	(2 * cone_radius)	// closer samples make the candidate infeasible [m]
+#define LATTICE_MAX_TRACK_WIDTH	2.0f	// nearest blue + nearest yellow distance above this is off track [m]
+#define LATTICE_SIDE_DISTANCE	0.3f	// target distance from the boundary when only one side is in range [m]
+#define LATTICE_W_CLEARANCE		0.05f
+#define LATTICE_W_CURVATURE		0.2f
+#define LATTICE_W_CENTER		2.0f
+#define LATTICE_W_PROGRESS		1.0f
+
+typedef struct {
+	long	runs;				// planning calls
+	long	candidates;			// candidates scored
+	long	infeasible_runs;	// calls where no candidate was feasible
+	long	scoring_us;			// wall time spent scoring (dispatch to last worker done)
+	int		n_workers;
+} lattice_stats_t;
+
+int		lattice_init(int n_workers);
+void	lattice_shutdown();
+
+// Same output as trajectory_planning(): waypoints of ctx->trajectory ending with a (-1, -1) sentinel
+void	lattice_planning(sim_context *ctx, float car_x, float car_y, float car_angle);
+
+void	lattice_get_stats(lattice_stats_t *stats);
+void	lattice_print_stats();
+
+#endif // LATTICE_H
@@ -0,0 +1,55 @@
+#ifndef MPC_H
+#define MPC_H
+
+#include "globals.h"
+#include "trajectory.h"
+#include "vehicle.h"
+
+/* Prediction */
+#define MPC_HORIZON			20		// steps of MPC_DT
+#define MPC_DT				0.1f	// prediction step, independent of the control rate [simulated s]
+#define MPC_SHIFT_TICKS		((int)(MPC_DT / VEHICLE_DT + 0.5f))	// control ticks per prediction step
+#define MPC_MIN_SPEED		0.05f	// speed floor in the lateral prediction [m/s]
+#define MPC_BRAKE_MARGIN	0.02f	// predicted speed above the reference that selects the brake model [m/s]
+
+/* Solver */
+#define MPC_BUDGET_US		500		// declared worst-case CPU time of one step (see controller.h)
+#define MPC_MAX_ITER		200
+#define MPC_TOL				1e-4f	// stop when no input moves more than this
+
+/* Weights */
+#define MPC_W_LATERAL		10.0f	// lateral error [1/m^2]
+#define MPC_W_HEADING		2.0f	// heading error [1/rad^2]
+#define MPC_W_STEER			0.1f	// tan(steering)
+#define MPC_W_STEER_RATE	2.0f	// change of tan(steering) between steps
+#define MPC_W_SPEED			1.0f	// speed error [s^2/m^2]
+#define MPC_W_PEDAL			0.001f
+#define MPC_W_PEDAL_RATE	0.01f
+
+// MPC_W_LATERAL, MPC_W_HEADING, MPC_W_STEER_RATE, MPC_W_SPEED unless changed with param_set()
+extern float	mpc_w_lateral, mpc_w_heading, mpc_w_steer_rate, mpc_w_speed;
+
+/* Warm start of one pipeline (see sim_context.h): previous solutions and last applied inputs */
+typedef struct {
+	float	u_steer[MPC_HORIZON], u_pedal[MPC_HORIZON];
+	float	last_steer, last_pedal;
+	int		ticks;						// control ticks since the last shift
+} mpc_state_t;
+
+typedef struct {
+	long	solves;
+	long	iterations;			// summed over both QPs of every solve
+	long	max_iter_hits;		// QPs stopped by MPC_MAX_ITER
+	int		last_iterations;
+	long	last_solve_us;
+	long	max_solve_us;
+	long	total_solve_us;
+} mpc_stats_t;
+
+// Same interface as autonomous_control(): computes ctx->pedal and ctx->steering
+void	mpc_control(sim_context *ctx, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path);
+
+void	mpc_get_stats(mpc_stats_t *stats);
+void	mpc_print_stats();
+
+#endif // MPC_H
@@ -0,0 +1,22 @@
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include <stdio.h>
+
+#include "globals.h"
+
+/* Tunable parameters: globals that can be changed at startup by name (2D_sim --set name=value) */
+enum { PARAM_INT, PARAM_FLOAT };
+
+typedef struct {
+	const char	*name;
+	int			type;
+	void		*value;			// int * or float *
+	const char	*description;
+} param_t;
+
+// Parses "name=value" and sets the parameter (all are positive); returns 0 if unknown or invalid
+int		param_set(const char *assignment);
+void	param_list(FILE *out);
+
+#endif // PARAMS_H
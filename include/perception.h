@@ -17,21 +17,22 @@ typedef struct {
 extern const float ignore_distance;
 
 extern const int sliding_window;
-extern const int angle_step;
+extern int angle_step;
+extern float distance_resolution;	// LiDAR range step [m]
 extern int start_angle;
 
-extern cone detected_cones[MAX_DETECTED_CONES];
+extern cone *const detected_cones;	// default_context.detected_cones
 
 typedef struct {
     int angles[MAX_POINTS_PER_CONE]; /**< Indices (angles) in the LiDAR scan that map to the same cone border */
     int color;                       /**< Color of the cone */
 } cone_border;
 
-extern cone track_map[MAX_CONES_MAP];
-extern int track_map_idx;
+extern cone *const track_map;	// default_context.track_map (default_context.track_map_idx cones)
 
 #define MAX_CANDIDATES 100000
 #define DETECTIONS_THRESHOLD 10
+extern int detections_threshold;	// DETECTIONS_THRESHOLD unless changed with param_set()
 
 typedef struct {
 	float x;
@@ -40,14 +41,16 @@ typedef struct {
 	int detections;  // Number of times this candidate has been detected
 } candidate_cone;
 
-// LiDAR measures
-void lidar(float car_x, float car_y, pointcloud_t *measures);
+// LiDAR measures (into ctx->measures)
+void lidar(sim_context *ctx, float car_x, float car_y);
 
-// Real-time mapping
-void mapping(float car_x, float car_y, int car_angle, cone *detected_cones);
-void check_nearest_point(int angle, float new_point_x, float new_point_y, int color, cone_border *cone_borders);
+// Real-time mapping: detect_cones(), then update_map()
+void mapping(sim_context *ctx, float car_x, float car_y, int car_angle);
+// Cones of the last scan (ctx->measures into ctx->detected_cones), the map is not touched
+void detect_cones(sim_context *ctx, float car_x, float car_y, int car_angle);
+void check_nearest_point(sim_context *ctx, int angle, float new_point_x, float new_point_y, int color, cone_border *cone_borders);
 
-// Update the map
-void update_map(cone *detected_cones); 
+// Update the map (ctx->detected_cones into ctx->candidates and ctx->track_map)
+void update_map(sim_context *ctx); 
 
 #endif // PERCEPTION_H
\ No newline at end of file
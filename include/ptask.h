@@ -6,8 +6,11 @@ extern "C" {
 #endif
 
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #include <string.h>  // For strerror()
 
@@ -25,6 +28,73 @@ extern "C" {
 #define ACT   1
 #define DEACT 0
 
+/*
+ * Scheduling policies (ptask_init): any POSIX policy, or
+ *   SCHED_DEADLINE  EDF by the kernel: runtime (task_set_runtime_us) every period,
+ *                   before the relative deadline, throttled beyond the runtime
+ *   PTASK_SCHED_RM  SCHED_FIFO with rate-monotonic priorities (shorter period first)
+ * A task that may not use its policy falls back to SCHED_FIFO RM, then to
+ * SCHED_OTHER (see task_policy()). SCHED_DEADLINE also requires the task to
+ * be allowed on every CPU: a task pinned with task_set_affinity() gets RM.
+ */
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#define PTASK_SCHED_RM 0x100
+#define PTASK_SCHED_CYCLIC 0x200    /* task_policy() of the jobs of the cyclic executive */
+
+/* Time sources (ptask_set_clock) */
+#define PTASK_CLOCK_REAL    0   /* CLOCK_MONOTONIC, tasks run concurrently (default) */
+#define PTASK_CLOCK_VIRTUAL 1   /* simulated time, one job at a time, reproducible */
+
+/*
+ * Job statistics histograms: values in ns, exact below 2^PTASK_HIST_SUB_BITS,
+ * then 2^PTASK_HIST_SUB_BITS buckets per power of two (relative error below
+ * 1 / 2^PTASK_HIST_SUB_BITS), up to 2^PTASK_HIST_MAX_LOG2 ns (~18 min).
+ */
+#define PTASK_HIST_SUB_BITS 3
+#define PTASK_HIST_MAX_LOG2 40
+#define PTASK_HIST_BUCKETS  ((PTASK_HIST_MAX_LOG2 - PTASK_HIST_SUB_BITS + 1) << PTASK_HIST_SUB_BITS)
+
+/*
+ * Precedence edges (task_precedence): at the end of each job that consumed a
+ * new input, a task passes the release time of the head of its chain to its
+ * successors, and activates those of TRIGGER edges. A task with an incoming
+ * TRIGGER edge is event-triggered: wait_for_period() waits for the next
+ * activation instead of the next period. A SAMPLE successor keeps its period
+ * and reads the last input at the start of each job.
+ */
+#define PTASK_MAX_SUCCESSORS 4
+#define PTASK_EDGE_TRIGGER   0
+#define PTASK_EDGE_SAMPLE    1
+
+/*
+ * Release times of the task_activate() calls not consumed yet, in order:
+ * each queued job starts from its own. Beyond PTASK_MAX_ACTIVATIONS pending
+ * activations the newest ones overwrite the oldest release times.
+ */
+#define PTASK_MAX_ACTIVATIONS 8
+
+/*
+ * CPU budgets (task_set_budget_us): what a job does once it has used the
+ * budget left to its constant bandwidth server, signalled by a timer on the
+ * CPU time of its thread (PTASK_BUDGET_SIGNAL).
+ */
+#define PTASK_BUDGET_DEMOTE 0   /* runs below the other tasks until the end of the job */
+#define PTASK_BUDGET_STOP   1   /* ptask_budget_exhausted() becomes true: the job stops by itself */
+#define PTASK_BUDGET_SIGNAL (SIGRTMIN + 1)
+
+/*
+ * Cyclic executive (cyclic_job): the jobs run inline in the thread of one
+ * task, frame by frame, from a table built over the hyperperiod of their
+ * periods. The minor frame is the GCD of the periods; a table with a frame
+ * shorter than the WCET of the jobs released in it is rejected.
+ */
+#define PTASK_CYCLIC_MAX_FRAMES 65536
+
+/* Fill of the stacks allocated by ptask: the words still equal to it were never used */
+#define PTASK_STACK_CANARY  0xC5A5C5A5C5A5C5A5ULL
+
 /* ---------------------------*/
 /*     Data Type Definitions  */
 /* ---------------------------*/
@@ -39,20 +109,87 @@ typedef struct timespec_custom {
     long   tv_nsec;
 } timespec_custom;
 
+/* Per-job measures (task_stats.metric index) */
+enum {
+    PTASK_LATENCY,     /* start - release */
+    PTASK_RESPONSE,    /* end - release, the end being the next wait_for_period() */
+    PTASK_EXEC,        /* CPU time of the thread from start to end */
+    PTASK_E2E,         /* end - release of the chain head job, jobs with a new input only */
+    PTASK_N_METRICS
+};
+
+typedef struct ptask_metric {
+    unsigned long count;
+    long min, max;                          /* ns */
+    long long sum;                          /* ns */
+    unsigned int hist[PTASK_HIST_BUCKETS];  /* see ptask_hist_bucket() */
+} ptask_metric;
+
+typedef struct task_stats {
+    unsigned long jobs;                     /* completed jobs */
+    unsigned long dmiss;                    /* jobs that ended after their deadline */
+    unsigned long faults;                   /* page faults (minor + major) during the jobs */
+    unsigned long warmup_faults;            /* page faults during the warm-up pass */
+    unsigned long e2e_miss;                 /* PTASK_E2E above the end-to-end deadline */
+    unsigned long overruns;                 /* jobs that used up their CPU budget */
+    unsigned long postponed;                /* server deadline postponements (budget refills) */
+    ptask_metric metric[PTASK_N_METRICS];
+} task_stats;
+
 /*
  * Task parameter structure.
  * Each periodic task is described by one instance of this structure.
  */
 typedef struct task_par {
     int arg;           /* Task index or identifier */
-    int period;        /* Period (in milliseconds) */
-    int deadline;      /* Relative deadline (in milliseconds) */
+    long period;       /* Period (in microseconds) */
+    long deadline;     /* Relative deadline (in microseconds) */
     int prio;          /* Scheduling priority */
+    long runtime;      /* CPU budget per period under SCHED_DEADLINE (in microseconds) */
+    int policy;        /* Policy in use: ptask_policy, or the one it fell back to */
+    int pinned;        /* Created with the affinity cpus (task_set_affinity) */
+    cpu_set_t cpus;    /* CPUs the task may run on, if pinned */
+    size_t stack_size; /* Stack allocated by ptask (0: default pthread stack) */
+    void *stack;       /* Its mapping, guard page included */
+    size_t stack_peak; /* Bytes of it used, measured when the task ended */
+    void (*warmup)(void);  /* Run once in the thread before the first activation */
+    sem_t ready;       /* Posted at the end of the warm-up */
+    long faults;       /* Page faults of the thread at the start of the current job */
+    timespec_custom act[PTASK_MAX_ACTIVATIONS];  /* Times of the pending task_activate() calls */
+    unsigned int act_in;   /* task_activate() calls so far (under ptask_act_mutex) */
+    unsigned int act_out;  /* Activations consumed by the task */
+    int triggered;         /* Released by a predecessor (PTASK_EDGE_TRIGGER), not by the clock */
+    int n_pred;            /* Incoming edges */
+    int n_succ;            /* Outgoing edges */
+    int succ[PTASK_MAX_SUCCESSORS];
+    int succ_type[PTASK_MAX_SUCCESSORS];
+    long long input;       /* Chain origin published by a predecessor [ns] */
+    unsigned long input_seq;   /* Incremented with each input */
+    unsigned long input_seen;  /* input_seq consumed by the last job */
+    long long origin;      /* Chain origin of the current job: release of the head job [ns] */
+    int fresh;             /* The current job consumed a new input */
+    long e2e_deadline;     /* End-to-end deadline from the chain origin (in microseconds, 0: none) */
+    void (*job)(void);     /* Job run by the cyclic executive (no thread of its own) */
+    long wcet;             /* Its worst-case execution time (in microseconds) */
+    int pending;           /* Activations of a triggered cyclic job not run yet */
+    long budget;           /* CPU budget per period of the server (in microseconds, 0: none) */
+    int budget_mode;       /* PTASK_BUDGET_DEMOTE or PTASK_BUDGET_STOP */
+    int budget_timer_ok;   /* budget_timer created by the thread */
+    timer_t budget_timer;  /* CLOCK_THREAD_CPUTIME_ID timer, armed during the jobs */
+    long long cbs_dl;      /* Server deadline [ns] */
+    long long cbs_left;    /* Budget left to the server [ns] */
+    volatile sig_atomic_t exhausted;  /* Budget refills during the current job */
+    int demoted;           /* Runs below its policy until the end of the job */
     int dmiss;         /* Deadline miss counter */
     timespec_custom at;/* Next activation time */
     timespec_custom dl;/* Current deadline time */
     pthread_t tid;     /* Thread identifier */
     sem_t asem;        /* Semaphore used for task activation */
+    timespec_custom rt;/* Release time of the current job */
+    timespec_custom st;/* Start time of the current job */
+    struct timespec ct;/* Thread CPU time at the start of the current job */
+    unsigned int seq;  /* Odd while stats is being written (seqlock) */
+    task_stats stats __attribute__((aligned(64)));  /* Written by the task only */
 } task_par;
 
 /* ---------------------------*/
@@ -67,6 +204,7 @@ typedef struct task_par {
 extern task_par tp[MAX_TASKS];
 extern timespec_custom ptask_t0;  /* Reference “zero‐time” for the system */
 extern int ptask_policy;          /* Scheduling policy to be used */
+extern int ptask_clock;           /* PTASK_CLOCK_REAL or PTASK_CLOCK_VIRTUAL */
 
 /* ---------------------------*/
 /*      Function Prototypes   */
@@ -75,10 +213,15 @@ extern int ptask_policy;          /* Scheduling policy to be used */
 /* Time utility functions */
 void time_copy(timespec_custom *td, timespec_custom ts);
 void time_add_ms(timespec_custom *t, int ms);
+void time_add_us(timespec_custom *t, long us);
 int  time_cmp(timespec_custom t1, timespec_custom t2);
 
 /* Initialization and system time */
+void ptask_set_clock(int clock);
 void ptask_init(int policy);
+void ptask_start(void);
+void ptask_gettime(timespec_custom *t);
+void ptask_clock_advance_us(long us);
 long get_systime(int unit);
 
 /* Periodic task support functions */
@@ -88,6 +231,12 @@ int  task_create(int i,
                  int drel,
                  int prio,
                  int aflag);
+int  task_create_us(int i,
+                    void *(*task)(void *),
+                    long period_us,
+                    long drel_us,
+                    int prio,
+                    int aflag);
 int  get_task_index(void *arg);
 void wait_for_activation(int i);
 void task_activate(int i);
@@ -95,13 +244,99 @@ int  deadline_miss(int i);
 void wait_for_period(int i);
 void task_set_period(int i, int per);
 void task_set_deadline(int i, int drel);
+void task_set_period_us(int i, long per_us);
+void task_set_deadline_us(int i, long drel_us);
+void task_set_runtime_us(int i, long runtime_us);  /* before task_create() */
+int  task_policy(int i);
+const char *ptask_policy_name(int policy);
+
+/*
+ * Real-time start-up. ptask_lock_memory() locks the pages of the process,
+ * present and future, and keeps heap_bytes of prefaulted heap (never given
+ * back to the kernel). Before task_create(): task_set_stack_size() gives the
+ * task a stack allocated and prefaulted by ptask (with a guard page), and
+ * task_set_warmup() a function run once in its thread, on its stack, before
+ * task_create() returns and activates it.
+ * The page faults of the jobs (getrusage() at each job start and end) are
+ * only counted after ptask_count_faults(1), which ptask_lock_memory() calls.
+ */
+int  ptask_lock_memory(size_t heap_bytes);  /* 0 on success */
+void ptask_count_faults(int on);
+void task_set_stack_size(int i, size_t bytes);
+void task_set_warmup(int i, void (*warmup)(void));
+
+/*
+ * Stacks allocated by ptask are filled with PTASK_STACK_CANARY: the peak
+ * usage is the part overwritten since task_create(), TLS included. On demand
+ * while the task runs (scan of the stack), or after wait_for_task_end().
+ * Both are 0 for a task on a default pthread stack.
+ */
+size_t task_stack_size(int i);
+size_t task_stack_peak(int i);
+
+/* Activation graph: set before task_create(); a triggered task is normally created DEACT */
+int  task_precedence(int from, int to, int type);  /* 0 on success */
+void task_set_e2e_deadline_us(int i, long e2e_us);
+
+/*
+ * CPU budgets: constant bandwidth server (CBS) of budget_us every period,
+ * set before task_create(), real clock only. A job released while the
+ * server has more budget left than its bandwidth until the server deadline
+ * gets a new deadline (release + period) and the full budget. When a job
+ * uses up the budget, the deadline is postponed by one period, the budget
+ * refilled (both counted in the statistics) and the job demoted or asked to
+ * stop (mode). Demotion needs the right to restore the policy: real-time
+ * tasks go to SCHED_OTHER, SCHED_OTHER tasks to SCHED_IDLE if privileged,
+ * else the overrun is only counted. Under SCHED_DEADLINE the kernel
+ * throttles the task at its runtime anyway: in both modes the overrun is
+ * only counted, and ptask_budget_exhausted() stays 0.
+ */
+void task_set_budget_us(int i, long budget_us, int mode);
+int  ptask_budget_exhausted(void);  /* job of the calling task out of budget (0 outside tasks) */
+
+/*
+ * Cyclic executive. cyclic_job() declares a task without a thread: its jobs
+ * run inline in the thread of the executive, a periodic task calling
+ * cyclic_frame() once per minor frame (returned by cyclic_build()). In each
+ * frame the released jobs run in deadline-monotonic order, each triggered
+ * job right after the job activating it. The jobs have their statistics as
+ * threads do; wait_for_task_end() returns at once for them.
+ *
+ * cyclic_build() rejects the table (returns 0) if a frame does not divide the
+ * hyperperiod, or if the WCETs of the jobs released in a frame, with the jobs
+ * they trigger, add up to more than the frame: a job longer than the frame
+ * has to be sliced, or run as a thread outside the executive.
+ */
+int  cyclic_job(int i, void (*job)(void), long period_us, long drel_us, long wcet_us);  /* 0 on success */
+long cyclic_build(void);    /* minor frame in us, 0 if no job, no valid table or more than PTASK_CYCLIC_MAX_FRAMES */
+int  cyclic_frames(void);   /* frames of the table, over the hyperperiod */
+void cyclic_frame(int e);   /* called by the executive task e, once per period */
+
+/* CPU placement: set before task_create() (NULL: any CPU), read back from the running thread */
+void task_set_affinity(int i, const cpu_set_t *cpus);
+int  task_get_affinity(int i, cpu_set_t *cpus);  /* 0 on success */
+int  ptask_isolated_cpus(cpu_set_t *cpus);       /* CPUs isolated from the scheduler (isolcpus=), returns their number */
 int  task_period(int i);
 int  task_deadline(int i);
+long task_period_us(int i);
+long task_deadline_us(int i);
 int  task_dmiss(int i);
+
+/* Job statistics: consistent copy at any time, from any thread */
+void task_get_stats(int i, task_stats *stats);
+void task_reset_stats(int i);   /* from the task itself, or while it does not run */
+long ptask_metric_percentile(const ptask_metric *m, double p);  /* upper bound of the bucket [ns] */
+int  ptask_hist_bucket(long ns);
+long ptask_hist_upper(int bucket);  /* largest value of the bucket [ns] */
+void task_print_stats(int i, const char *name);  /* profiler rows [name],KEY,value */
 void task_atime(int i, timespec_custom *at);
 void task_adline(int i, timespec_custom *dl);
 void wait_for_task_end(int i);
 
+/* Semaphores shared by tasks (sem_wait/sem_post on the real clock) */
+void task_sem_wait(sem_t *s);
+void task_sem_post(sem_t *s);
+
 #ifdef __cplusplus
 }
 #endif
@@ -113,10 +348,54 @@ void wait_for_task_end(int i);
 /* -----------------------------------------------------------------*/
 #ifdef PTASK_IMPLEMENTATION
 
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
 /* Global variable definitions */
 task_par tp[MAX_TASKS];
 timespec_custom ptask_t0;
 int ptask_policy;
+int ptask_clock = PTASK_CLOCK_REAL;
+static int ptask_faults_on = 0;    /* ptask_count_faults() */
+
+/* Cyclic executive: table[f] has bit k set if order[k] is released in frame f */
+static struct {
+    int n;                  /* cyclic jobs, in deadline-monotonic order */
+    int order[MAX_TASKS];
+    int frames, frame;      /* table size, next frame */
+    uint32_t *table;
+} ptask_cyclic;
+
+/*
+ * Virtual clock.
+ * Time is a counter that only advances when every task is blocked: then it
+ * jumps to the earliest pending activation. Jobs take no simulated time and
+ * run one at a time, the highest priority first (lowest index on ties), so
+ * the order of the activations, and the outputs of the tasks, are the same
+ * on every run and on every machine. A task holds the CPU from its release
+ * to its next wait_for_period(), wait_for_activation() or task_sem_wait().
+ */
+enum { VC_FREE, VC_STARTING, VC_IDLE, VC_READY, VC_RUNNING, VC_SLEEPING, VC_EVENT, VC_DONE };
+
+static struct {
+    int state;
+    int activated;              /* task_activate() calls not consumed yet by the task */
+    timespec_custom wake;       /* VC_SLEEPING: release time */
+    sem_t *event;               /* VC_EVENT: semaphore waited for */
+    void *(*body)(void *);
+} vc_task[MAX_TASKS];
+
+static timespec_custom vc_now;
+static int vc_started;                  /* ptask_start() called */
+static pthread_mutex_t vc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vc_cond = PTHREAD_COND_INITIALIZER;
+static __thread int ptask_self = -1;    /* index of the calling task, -1 elsewhere */
+static pthread_mutex_t ptask_act_mutex = PTHREAD_MUTEX_INITIALIZER;  /* writers of the act queues */
 
 /* Copies the content of a timespec_custom into another. */
 void time_copy(timespec_custom *td, timespec_custom ts)
@@ -128,9 +407,17 @@ void time_copy(timespec_custom *td, timespec_custom ts)
 /* Adds a given number of milliseconds to a timespec_custom value. */
 void time_add_ms(timespec_custom *t, int ms)
 {
-    t->tv_sec += ms / 1000;
-    t->tv_nsec += (ms % 1000) * 1000000;
-    if (t->tv_nsec > 1000000000) {
+    time_add_us(t, ms * 1000L);
+}
+
+/* Adds a given number of microseconds to a timespec_custom value.
+ * tv_nsec is kept in [0, 1e9): exactly one second carries over too.
+ */
+void time_add_us(timespec_custom *t, long us)
+{
+    t->tv_sec += us / 1000000;
+    t->tv_nsec += (us % 1000000) * 1000;
+    while (t->tv_nsec >= 1000000000) {
         t->tv_nsec -= 1000000000;
         t->tv_sec++;
     }
@@ -152,6 +439,174 @@ int time_cmp(timespec_custom t1, timespec_custom t2)
     return 0;
 }
 
+/*
+ * Gives the CPU to the next task, called with vc_mutex held whenever a task
+ * blocks or starts. Nothing is decided while a task is running or has not
+ * reached its first wait_for_activation(), so that thread start-up times
+ * do not change the order.
+ */
+static void vc_schedule(void)
+{
+    int i, next = -1, sleeping = -1;
+
+    if (!vc_started)
+        return;
+    for (i = 0; i < MAX_TASKS; i++)
+        if (vc_task[i].state == VC_STARTING || vc_task[i].state == VC_RUNNING)
+            return;
+
+    for (i = 0; i < MAX_TASKS; i++) {
+        if (vc_task[i].state == VC_SLEEPING && time_cmp(vc_task[i].wake, vc_now) <= 0)
+            vc_task[i].state = VC_READY;
+        if (vc_task[i].state == VC_READY && (next < 0 || tp[i].prio > tp[next].prio))
+            next = i;
+    }
+
+    if (next < 0) {
+        /* Everybody blocked: advance to the earliest release */
+        for (i = 0; i < MAX_TASKS; i++)
+            if (vc_task[i].state == VC_SLEEPING &&
+                (sleeping < 0 || time_cmp(vc_task[i].wake, vc_task[sleeping].wake) < 0))
+                sleeping = i;
+        if (sleeping < 0)
+            return; /* no periodic task left */
+
+        vc_now = vc_task[sleeping].wake;
+        for (i = 0; i < MAX_TASKS; i++) {
+            if (vc_task[i].state == VC_SLEEPING && time_cmp(vc_task[i].wake, vc_now) <= 0)
+                vc_task[i].state = VC_READY;
+            if (vc_task[i].state == VC_READY && (next < 0 || tp[i].prio > tp[next].prio))
+                next = i;
+        }
+    }
+
+    vc_task[next].state = VC_RUNNING;
+    pthread_cond_broadcast(&vc_cond);
+}
+
+/* Task i has just blocked (state set by the caller, vc_mutex held): waits for the CPU */
+static void vc_wait_cpu(int i)
+{
+    vc_schedule();
+    while (vc_task[i].state != VC_RUNNING)
+        pthread_cond_wait(&vc_cond, &vc_mutex);
+}
+
+/* Thread body of a task on the virtual clock: gives the CPU back when it returns */
+static void *vc_trampoline(void *arg)
+{
+    int i = ((task_par *)arg)->arg;
+    void *ret;
+
+    ptask_self = i;
+    ret = vc_task[i].body(arg);
+
+    pthread_mutex_lock(&vc_mutex);
+    vc_task[i].state = VC_DONE;
+    vc_schedule();
+    pthread_mutex_unlock(&vc_mutex);
+    return ret;
+}
+
+/* Argument of sched_setattr(2), which has no glibc wrapper */
+struct ptask_sched_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t  sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;     /* ns */
+    uint64_t sched_deadline;    /* ns */
+    uint64_t sched_period;      /* ns */
+};
+
+/*
+ * SCHED_FIFO priority of a task under PTASK_SCHED_RM: one level less every
+ * quarter octave of the period, so that any task set gets the rate-monotonic
+ * order without knowing the other tasks (close periods may share a level).
+ */
+static int ptask_rm_priority(long period_us)
+{
+    int e, prio;
+    int lo = sched_get_priority_min(SCHED_FIFO), hi = sched_get_priority_max(SCHED_FIFO);
+
+    if (period_us < 4)
+        return hi;
+    e = 63 - __builtin_clzl((unsigned long)period_us);
+    prio = hi - (4 * e + (int)((period_us >> (e - 2)) & 3));
+    return prio < lo ? lo : prio;
+}
+
+/*
+ * SCHED_DEADLINE cannot be set through pthread attributes: the thread of
+ * task i sets it on itself. When the kernel refuses (no privileges, no
+ * runtime, admission test failed), falls back to RM, then to SCHED_OTHER.
+ */
+static void ptask_set_deadline_policy(int i)
+{
+    struct ptask_sched_attr attr;
+    struct sched_param param;
+    const char *reason = "no runtime set";
+
+    if (tp[i].runtime > 0) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.sched_policy   = SCHED_DEADLINE;
+        attr.sched_runtime  = tp[i].runtime * 1000ULL;
+        attr.sched_deadline = tp[i].deadline * 1000ULL;
+        attr.sched_period   = tp[i].period * 1000ULL;
+#ifdef SYS_sched_setattr
+        if (syscall(SYS_sched_setattr, 0, &attr, 0) == 0)
+            return;
+#else
+        errno = ENOSYS;
+#endif
+        reason = strerror(errno);
+    }
+
+    param.sched_priority = ptask_rm_priority(tp[i].period);
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+        tp[i].policy = PTASK_SCHED_RM;
+    else
+        tp[i].policy = SCHED_OTHER;
+    fprintf(stderr, "ptask: task %d: SCHED_DEADLINE not applied (%s), using %s\n",
+            i, reason, ptask_policy_name(tp[i].policy));
+}
+
+/*
+ * Selects the time source of get_systime(), activations and deadlines.
+ * Must be called before ptask_init(); PTASK_CLOCK_REAL is the default.
+ */
+void ptask_set_clock(int clock)
+{
+    ptask_clock = clock;
+}
+
+/* Current time of the selected clock (the virtual clock starts at 0). */
+void ptask_gettime(timespec_custom *t)
+{
+    if (ptask_clock == PTASK_CLOCK_VIRTUAL) {
+        pthread_mutex_lock(&vc_mutex);
+        *t = vc_now;
+        pthread_mutex_unlock(&vc_mutex);
+    }
+    else
+        clock_gettime(CLOCK_MONOTONIC, (struct timespec *)t);
+}
+
+/*
+ * Advances the virtual clock, for drivers that release jobs themselves
+ * instead of creating tasks. No effect on the real clock.
+ */
+void ptask_clock_advance_us(long us)
+{
+    if (ptask_clock != PTASK_CLOCK_VIRTUAL)
+        return;
+    pthread_mutex_lock(&vc_mutex);
+    time_add_us(&vc_now, us);
+    pthread_mutex_unlock(&vc_mutex);
+}
+
 /*
  * Initializes the periodic task system.
  * This function sets the scheduling policy and gets a reference system time.
@@ -161,14 +616,54 @@ void ptask_init(int policy)
 {
     int i;
     ptask_policy = policy;
-    /* Use a cast here because ptask_t0 is timespec_custom but clock_gettime expects a struct timespec*.
-       (This is safe provided timespec_custom has the same layout as struct timespec.) */
-    clock_gettime(CLOCK_MONOTONIC, (struct timespec *)&ptask_t0);
+    vc_now.tv_sec = 0;
+    vc_now.tv_nsec = 0;
+    vc_started = 0;
+    /* ptask_gettime() casts timespec_custom to struct timespec for clock_gettime()
+       (this is safe provided timespec_custom has the same layout as struct timespec) */
+    ptask_gettime(&ptask_t0);
+    ptask_cyclic.n = 0;
+    ptask_cyclic.frames = 0;
     for (i = 0; i < MAX_TASKS; i++) {
         sem_init(&tp[i].asem, 0, 0);
+        tp[i].runtime = 0;
+        tp[i].pinned = 0;
+        tp[i].stack_size = 0;
+        tp[i].stack_peak = 0;
+        tp[i].warmup = NULL;
+        tp[i].triggered = 0;
+        tp[i].n_pred = 0;
+        tp[i].n_succ = 0;
+        tp[i].input_seq = 0;
+        tp[i].input_seen = 0;
+        tp[i].e2e_deadline = 0;
+        tp[i].job = NULL;
+        tp[i].pending = 0;
+        tp[i].act_in = 0;
+        tp[i].act_out = 0;
+        tp[i].budget = 0;
+        tp[i].budget_timer_ok = 0;
+        tp[i].exhausted = 0;
+        tp[i].demoted = 0;
+        vc_task[i].state = VC_FREE;
+        vc_task[i].activated = 0;
     }
 }
 
+/*
+ * On the virtual clock, tasks do not run before ptask_start(), so that the
+ * tasks created one after the other are all released at time 0.
+ * No effect on the real clock, where tasks run as soon as they are activated.
+ */
+void ptask_start(void)
+{
+    pthread_mutex_lock(&vc_mutex);
+    vc_started = 1;
+    if (ptask_clock == PTASK_CLOCK_VIRTUAL)
+        vc_schedule();
+    pthread_mutex_unlock(&vc_mutex);
+}
+
 /*
  * Returns the elapsed time (since ptask_init) in the specified unit.
  * Use MICRO for microseconds and NANO for nanoseconds.
@@ -182,12 +677,67 @@ long get_systime(int unit)
         case NANO:  mul = 1000;    div = 1000000; break;
         default:    mul = 1000;    div = 1000000; break;
     }
-    clock_gettime(CLOCK_MONOTONIC, (struct timespec *)&t);
+    ptask_gettime(&t);
     tu = (t.tv_sec - ptask_t0.tv_sec) * mul;
     tu += (t.tv_nsec - ptask_t0.tv_nsec) / div;
     return tu;
 }
 
+/*
+ * Stack of task i (stack_size bytes): mapped with a guard page below it, so
+ * that an overflow faults, then filled with the canary, which also makes
+ * every page present.
+ */
+static int ptask_alloc_stack(int i)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (tp[i].stack_size + page - 1) / page * page;
+    size_t k;
+    uint64_t *words;
+    char *base;
+
+    if (size < (size_t)PTHREAD_STACK_MIN)
+        size = (size_t)PTHREAD_STACK_MIN;
+    base = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED)
+        return errno;
+    if (mprotect(base, page, PROT_NONE) != 0) {
+        int err = errno;
+        munmap(base, size + page);
+        return err;
+    }
+    words = (uint64_t *)(base + page);
+    for (k = 0; k < size / sizeof(uint64_t); k++)
+        words[k] = PTASK_STACK_CANARY;
+
+    tp[i].stack = base;
+    tp[i].stack_size = size;
+    tp[i].stack_peak = 0;
+    return 0;
+}
+
+/* The stack grows down: the used part starts at the lowest word that is not the canary */
+static size_t ptask_scan_stack(int i)
+{
+    const volatile uint64_t *words =
+        (const volatile uint64_t *)((char *)tp[i].stack + sysconf(_SC_PAGESIZE));
+    size_t n = tp[i].stack_size / sizeof(uint64_t), k = 0;
+
+    while (k < n && words[k] == PTASK_STACK_CANARY)
+        k++;
+    return (n - k) * sizeof(uint64_t);
+}
+
+static void ptask_free_stack(int i)
+{
+    if (tp[i].stack == NULL)
+        return;
+    tp[i].stack_peak = ptask_scan_stack(i);
+    munmap(tp[i].stack, tp[i].stack_size + (size_t)sysconf(_SC_PAGESIZE));
+    tp[i].stack = NULL;
+}
+
 /*
  * Creates a periodic task.
  *
@@ -208,6 +758,19 @@ int task_create(int i,
                 int drel,
                 int prio,
                 int aflag)
+{
+    return task_create_us(i, task, period * 1000L, drel * 1000L, prio, aflag);
+}
+
+/*
+ * Same as task_create(), with period and relative deadline in microseconds.
+ */
+int task_create_us(int i,
+                   void *(*task)(void *),
+                   long period_us,
+                   long drel_us,
+                   int prio,
+                   int aflag)
 {
     pthread_attr_t myatt;
     struct sched_param mypar;
@@ -218,24 +781,74 @@ int task_create(int i,
         return -1;
     }
     tp[i].arg      = i;
-    tp[i].period   = period;
-    tp[i].deadline = drel;
+    tp[i].period   = period_us;
+    tp[i].deadline = drel_us;
     tp[i].prio     = prio;
     tp[i].dmiss    = 0;
+    tp[i].policy   = ptask_policy;
+    task_reset_stats(i);
 
     pthread_attr_init(&myatt);
     pthread_attr_setinheritsched(&myatt, PTHREAD_EXPLICIT_SCHED);
-    pthread_attr_setschedpolicy(&myatt, ptask_policy);
-
-    mypar.sched_priority = tp[i].prio;
+    if (ptask_policy == PTASK_SCHED_RM) {
+        pthread_attr_setschedpolicy(&myatt, SCHED_FIFO);
+        mypar.sched_priority = ptask_rm_priority(period_us);
+    }
+    else {
+        pthread_attr_setschedpolicy(&myatt, ptask_policy);
+        mypar.sched_priority = tp[i].prio;
+    }
     pthread_attr_setschedparam(&myatt, &mypar);
 
+    if (ptask_policy == SCHED_DEADLINE)
+        /* Set by the thread in wait_for_activation() */
+        pthread_attr_setinheritsched(&myatt, PTHREAD_INHERIT_SCHED);
+    if (tp[i].pinned)
+        pthread_attr_setaffinity_np(&myatt, sizeof(cpu_set_t), &tp[i].cpus);
+    if (tp[i].stack_size > 0) {
+        tret = ptask_alloc_stack(i);
+        if (tret != 0) {
+            fprintf(stderr, "stack allocation error for task %d: %s\n", i, strerror(tret));
+            return tret;
+        }
+        pthread_attr_setstack(&myatt, (char *)tp[i].stack + sysconf(_SC_PAGESIZE), tp[i].stack_size);
+    }
+    if (tp[i].warmup != NULL)
+        sem_init(&tp[i].ready, 0, 0);
+
+    if (ptask_clock == PTASK_CLOCK_VIRTUAL) {
+        /* One job at a time: the real-time policy is not needed (nor allowed without privileges) */
+        pthread_attr_setinheritsched(&myatt, PTHREAD_INHERIT_SCHED);
+        pthread_mutex_lock(&vc_mutex);
+        vc_task[i].state = VC_STARTING;
+        vc_task[i].activated = 0;
+        vc_task[i].body = task;
+        pthread_mutex_unlock(&vc_mutex);
+        task = vc_trampoline;
+    }
+
     tret = pthread_create(&tp[i].tid, &myatt, task, (void *)&tp[i]);
+    if (tret == EPERM) {
+        fprintf(stderr, "ptask: task %d: %s not permitted, using SCHED_OTHER\n",
+                i, ptask_policy_name(ptask_policy));
+        pthread_attr_setinheritsched(&myatt, PTHREAD_INHERIT_SCHED);
+        tp[i].policy = SCHED_OTHER;
+        tret = pthread_create(&tp[i].tid, &myatt, task, (void *)&tp[i]);
+    }
     if (tret != 0) {
         fprintf(stderr, "pthread_create error for task %d: %s\n", i, strerror(tret));
+        ptask_free_stack(i);
+        if (ptask_clock == PTASK_CLOCK_VIRTUAL) {
+            pthread_mutex_lock(&vc_mutex);
+            vc_task[i].state = VC_FREE;
+            vc_schedule();
+            pthread_mutex_unlock(&vc_mutex);
+        }
         return tret;
     }
 
+    if (tp[i].warmup != NULL)
+        sem_wait(&tp[i].ready);
     if (aflag == ACT)
         task_activate(i);
 
@@ -249,6 +862,305 @@ int get_task_index(void *arg)
     return tpar->arg;
 }
 
+/* t1 - t2 in nanoseconds */
+static long ptask_diff_ns(timespec_custom t1, timespec_custom t2)
+{
+    return (t1.tv_sec - t2.tv_sec) * 1000000000L + (t1.tv_nsec - t2.tv_nsec);
+}
+
+/* Histogram bucket of a value in ns (negative values count as 0) */
+int ptask_hist_bucket(long ns)
+{
+    int e, bucket;
+
+    if (ns < (1L << PTASK_HIST_SUB_BITS))
+        return ns < 0 ? 0 : (int)ns;
+    e = 63 - __builtin_clzl((unsigned long)ns);
+    bucket = ((e - PTASK_HIST_SUB_BITS + 1) << PTASK_HIST_SUB_BITS) +
+             (int)((ns >> (e - PTASK_HIST_SUB_BITS)) & ((1L << PTASK_HIST_SUB_BITS) - 1));
+    return bucket < PTASK_HIST_BUCKETS ? bucket : PTASK_HIST_BUCKETS - 1;
+}
+
+long ptask_hist_upper(int bucket)
+{
+    int e, sub;
+
+    if (bucket < (1 << PTASK_HIST_SUB_BITS))
+        return bucket;
+    e   = (bucket >> PTASK_HIST_SUB_BITS) + PTASK_HIST_SUB_BITS - 1;
+    sub = bucket & ((1 << PTASK_HIST_SUB_BITS) - 1);
+    return ((((1L << PTASK_HIST_SUB_BITS) + sub + 1) << (e - PTASK_HIST_SUB_BITS))) - 1;
+}
+
+static void ptask_metric_add(ptask_metric *m, long ns)
+{
+    if (m->count == 0 || ns < m->min)
+        m->min = ns;
+    if (m->count == 0 || ns > m->max)
+        m->max = ns;
+    m->count++;
+    m->sum += ns;
+    m->hist[ptask_hist_bucket(ns)]++;
+}
+
+/* Minor and major page faults of the calling thread */
+static long ptask_thread_faults(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+static long long ptask_ns(timespec_custom t)
+{
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void ptask_ns_to_timespec(long long ns, struct timespec *t)
+{
+    t->tv_sec = ns / 1000000000LL;
+    t->tv_nsec = ns % 1000000000LL;
+}
+
+/* Budget timer expired, in the thread of the task: one more refill, the first one demotes */
+static void ptask_budget_handler(int sig)
+{
+    struct sched_param param;
+    struct rlimit nice_limit;
+    int i = ptask_self, policy;
+
+    (void)sig;
+    if (i < 0)
+        return;
+    tp[i].exhausted++;
+    if (tp[i].exhausted > 1 || tp[i].budget_mode != PTASK_BUDGET_DEMOTE)
+        return;
+
+    param.sched_priority = 0;
+    if (tp[i].policy == SCHED_OTHER) {
+        /* Back to SCHED_OTHER from SCHED_IDLE: nice 0 must be allowed */
+        if (getrlimit(RLIMIT_NICE, &nice_limit) != 0 || (geteuid() != 0 && nice_limit.rlim_cur < 20))
+            return;
+        policy = SCHED_IDLE;
+    }
+    else if (tp[i].policy == SCHED_DEADLINE)
+        return;
+    else
+        policy = SCHED_OTHER;
+    tp[i].demoted = (sched_setscheduler(0, policy, &param) == 0);
+}
+
+/* Declared by glibc only from 2.41, the field has always been there */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/* In the thread: CPU time timer of the budget, not armed yet */
+static void ptask_budget_init(int i)
+{
+    struct sigaction action;
+    struct sigevent event;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = ptask_budget_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(PTASK_BUDGET_SIGNAL, &action, NULL);
+
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = PTASK_BUDGET_SIGNAL;
+    event.sigev_notify_thread_id = syscall(SYS_gettid);
+    tp[i].budget_timer_ok = (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &tp[i].budget_timer) == 0);
+    if (!tp[i].budget_timer_ok)
+        fprintf(stderr, "ptask: task %d: no budget timer (%s)\n", i, strerror(errno));
+    tp[i].cbs_dl = 0;
+    tp[i].cbs_left = 0;
+}
+
+/* CBS rule at the release of a job, then the timer for the budget left */
+static void ptask_budget_start(int i)
+{
+    long long release = ptask_ns(tp[i].rt);
+    long long budget = tp[i].budget * 1000LL, period = tp[i].period * 1000LL;
+    struct itimerspec timer;
+
+    if (release >= tp[i].cbs_dl || tp[i].cbs_left <= 0 ||
+        tp[i].cbs_left >= (tp[i].cbs_dl - release) * budget / period) {
+        tp[i].cbs_dl = release + period;
+        tp[i].cbs_left = budget;
+    }
+    ptask_ns_to_timespec(tp[i].cbs_left, &timer.it_value);
+    ptask_ns_to_timespec(budget, &timer.it_interval);
+    timer_settime(tp[i].budget_timer, 0, &timer, NULL);
+}
+
+/* Disarms the timer: budget left, postponements of the job (returned), policy back */
+static int ptask_budget_end(int i)
+{
+    struct itimerspec off, left;
+    struct sched_param param;
+    int policy, refills;
+
+    memset(&off, 0, sizeof(off));
+    timer_settime(tp[i].budget_timer, 0, &off, &left);
+    refills = tp[i].exhausted;
+    tp[i].exhausted = 0;
+    tp[i].cbs_left = (long long)left.it_value.tv_sec * 1000000000LL + left.it_value.tv_nsec;
+    tp[i].cbs_dl += refills * tp[i].period * 1000LL;
+
+    if (tp[i].demoted) {
+        policy = tp[i].policy;
+        param.sched_priority = 0;
+        if (policy == PTASK_SCHED_RM) {
+            policy = SCHED_FIFO;
+            param.sched_priority = ptask_rm_priority(tp[i].period);
+        }
+        else if (policy == SCHED_FIFO || policy == SCHED_RR)
+            param.sched_priority = tp[i].prio;
+        pthread_setschedparam(pthread_self(), policy, &param);
+        tp[i].demoted = 0;
+    }
+    return refills;
+}
+
+/*
+ * Start of a job: the release time (rt) is already set. A head task starts
+ * a chain at its release, the others take the last input of a predecessor.
+ */
+static void ptask_job_start(int i)
+{
+    unsigned long seq;
+
+    ptask_gettime(&tp[i].st);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp[i].ct);
+    if (ptask_faults_on)
+        tp[i].faults = ptask_thread_faults();
+    if (tp[i].budget_timer_ok)
+        ptask_budget_start(i);
+
+    if (tp[i].n_pred == 0) {
+        tp[i].origin = ptask_ns(tp[i].rt);
+        tp[i].fresh = 1;
+        return;
+    }
+    seq = __atomic_load_n(&tp[i].input_seq, __ATOMIC_ACQUIRE);
+    tp[i].fresh = (seq != tp[i].input_seen);
+    if (tp[i].fresh) {
+        tp[i].input_seen = seq;
+        tp[i].origin = __atomic_load_n(&tp[i].input, __ATOMIC_RELAXED);
+    }
+}
+
+/* End of a job with a new input: the successors get its origin, the triggered ones are released */
+static void ptask_signal_successors(int i)
+{
+    int k, s;
+
+    for (k = 0; k < tp[i].n_succ; k++) {
+        s = tp[i].succ[k];
+        __atomic_store_n(&tp[s].input, tp[i].origin, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&tp[s].input_seq, 1, __ATOMIC_RELEASE);
+        if (tp[i].succ_type[k] == PTASK_EDGE_TRIGGER)
+            task_activate(s);
+    }
+}
+
+/*
+ * End of a job, called by the task itself: only this thread writes the
+ * statistics, readers get a consistent copy through the sequence counter.
+ */
+static void ptask_job_end(int i)
+{
+    timespec_custom now;
+    struct timespec cpu;
+    task_stats *s = &tp[i].stats;
+    long faults = ptask_faults_on ? ptask_thread_faults() - tp[i].faults : 0;
+    long e2e = 0;
+    int miss, e2e_miss = 0, refills = 0;
+
+    ptask_gettime(&now);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    if (tp[i].budget_timer_ok)
+        refills = ptask_budget_end(i);
+    miss = time_cmp(now, tp[i].dl) > 0;
+    if (miss)
+        tp[i].dmiss++;
+    if (tp[i].n_pred > 0 && tp[i].fresh) {
+        e2e = (long)(ptask_ns(now) - tp[i].origin);
+        e2e_miss = tp[i].e2e_deadline > 0 && e2e > tp[i].e2e_deadline * 1000L;
+    }
+
+    __atomic_store_n(&tp[i].seq, tp[i].seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->jobs++;
+    s->dmiss += miss;
+    s->faults += faults;
+    ptask_metric_add(&s->metric[PTASK_LATENCY], ptask_diff_ns(tp[i].st, tp[i].rt));
+    ptask_metric_add(&s->metric[PTASK_RESPONSE], ptask_diff_ns(now, tp[i].rt));
+    ptask_metric_add(&s->metric[PTASK_EXEC],
+                     (cpu.tv_sec - tp[i].ct.tv_sec) * 1000000000L + (cpu.tv_nsec - tp[i].ct.tv_nsec));
+    if (tp[i].n_pred > 0 && tp[i].fresh) {
+        ptask_metric_add(&s->metric[PTASK_E2E], e2e);
+        s->e2e_miss += e2e_miss;
+    }
+    s->overruns += (refills > 0);
+    s->postponed += refills;
+    __atomic_store_n(&tp[i].seq, tp[i].seq + 1, __ATOMIC_RELEASE);
+
+    if (tp[i].fresh)
+        ptask_signal_successors(i);
+}
+
+/* Warm-up pass of task i, in its thread: page faults and cold caches before the first job */
+static void ptask_warmup(int i)
+{
+    long faults = ptask_thread_faults();
+
+    tp[i].warmup();
+    faults = ptask_thread_faults() - faults;
+
+    __atomic_store_n(&tp[i].seq, tp[i].seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    tp[i].stats.warmup_faults = faults;
+    __atomic_store_n(&tp[i].seq, tp[i].seq + 1, __ATOMIC_RELEASE);
+
+    sem_post(&tp[i].ready);
+}
+
+/*
+ * Release time of the next pending activation of task i, in the order of
+ * the task_activate() calls. The activation is consumed first (semaphore,
+ * virtual clock or pending count), which orders the read after the write.
+ */
+static void ptask_pop_activation(int i)
+{
+    tp[i].rt = tp[i].act[tp[i].act_out % PTASK_MAX_ACTIVATIONS];
+    tp[i].act_out++;
+}
+
+/* Blocks until the next task_activate() of task i (one per call), then starts the job it released */
+static void ptask_wait_activation(int i)
+{
+    if (ptask_clock == PTASK_CLOCK_VIRTUAL) {
+        pthread_mutex_lock(&vc_mutex);
+        if (vc_task[i].activated > 0) {
+            vc_task[i].activated--;
+            vc_task[i].state = VC_READY;
+        }
+        else
+            vc_task[i].state = VC_IDLE;
+        vc_wait_cpu(i);
+        pthread_mutex_unlock(&vc_mutex);
+    }
+    else
+        while (sem_wait(&tp[i].asem) != 0 && errno == EINTR)
+            ;
+    ptask_pop_activation(i);
+    ptask_job_start(i);
+}
+
 /*
  * Blocks the calling thread until the task is activated.
  * After activation, it saves the current time into the task’s activation and
@@ -257,65 +1169,416 @@ int get_task_index(void *arg)
 void wait_for_activation(int i)
 {
     timespec_custom t;
-    sem_wait(&tp[i].asem);
-    clock_gettime(CLOCK_MONOTONIC, (struct timespec *)&t);
+    if (tp[i].warmup != NULL)
+        ptask_warmup(i);
+    if (ptask_clock == PTASK_CLOCK_REAL && tp[i].policy == SCHED_DEADLINE)
+        ptask_set_deadline_policy(i);
+    ptask_self = i;
+    if (ptask_clock == PTASK_CLOCK_REAL && tp[i].budget > 0)
+        ptask_budget_init(i);
+    ptask_wait_activation(i);
+    t = tp[i].st;
     time_copy(&tp[i].at, t);
     time_copy(&tp[i].dl, t);
-    time_add_ms(&tp[i].at, tp[i].period);
-    time_add_ms(&tp[i].dl, tp[i].deadline);
+    time_add_us(&tp[i].at, tp[i].period);
+    time_add_us(&tp[i].dl, tp[i].deadline);
 }
 
-/* Releases (activates) the task i by posting its semaphore. */
+/*
+ * Releases (activates) the task i by posting its semaphore: its first job,
+ * or the next job of an event-triggered task. Activations are counted.
+ */
 void task_activate(int i)
 {
-    sem_post(&tp[i].asem);
+    /* Release time queued before the activation is posted */
+    pthread_mutex_lock(&ptask_act_mutex);
+    ptask_gettime(&tp[i].act[tp[i].act_in % PTASK_MAX_ACTIVATIONS]);
+    tp[i].act_in++;
+    pthread_mutex_unlock(&ptask_act_mutex);
+    if (tp[i].job != NULL) {
+        tp[i].pending++;        /* run by the executive, see ptask_cyclic_run() */
+        return;
+    }
+    if (ptask_clock == PTASK_CLOCK_VIRTUAL) {
+        pthread_mutex_lock(&vc_mutex);
+        if (vc_task[i].state == VC_IDLE) {
+            vc_task[i].state = VC_READY;
+            vc_schedule();
+        }
+        else
+            vc_task[i].activated++;
+        pthread_mutex_unlock(&vc_mutex);
+    }
+    else
+        sem_post(&tp[i].asem);
 }
 
 /*
  * Checks whether the current time is past the task’s deadline.
- * If so, increments the deadline miss counter.
- * Returns 1 if a deadline miss occurred, 0 otherwise.
+ * Returns 1 if so, 0 otherwise. Misses are counted by wait_for_period(),
+ * which ends the job.
  */
 int deadline_miss(int i)
 {
     timespec_custom now;
-    clock_gettime(CLOCK_MONOTONIC, (struct timespec *)&now);
-    if (time_cmp(now, tp[i].dl) > 0) {
-        tp[i].dmiss++;
-        return 1;
-    }
-    return 0;
+    ptask_gettime(&now);
+    return time_cmp(now, tp[i].dl) > 0;
 }
 
 /*
  * Waits for the next period.
  * Uses absolute time (via clock_nanosleep) to avoid cumulative drift.
+ * The call ends the current job: its times and deadline miss are recorded
+ * in the task statistics, the next job being released at the activation time.
+ * An event-triggered task waits for its next activation instead, its
+ * deadline counting from the activation.
  */
 void wait_for_period(int i)
 {
-    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
-                    (struct timespec *)&tp[i].at, NULL);
-    time_add_ms(&tp[i].at, tp[i].period);
-    time_add_ms(&tp[i].dl, tp[i].period);
+    ptask_job_end(i);
+    if (tp[i].triggered) {
+        ptask_wait_activation(i);
+        tp[i].dl = tp[i].rt;
+        time_add_us(&tp[i].dl, tp[i].deadline);
+        return;
+    }
+    tp[i].rt = tp[i].at;
+    if (ptask_clock == PTASK_CLOCK_VIRTUAL) {
+        pthread_mutex_lock(&vc_mutex);
+        vc_task[i].state = VC_SLEEPING;
+        vc_task[i].wake = tp[i].at;
+        vc_wait_cpu(i);
+        pthread_mutex_unlock(&vc_mutex);
+    }
+    else
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                               (struct timespec *)&tp[i].at, NULL) == EINTR)
+            ;
+    ptask_job_start(i);
+    time_add_us(&tp[i].at, tp[i].period);
+    time_add_us(&tp[i].dl, tp[i].period);
 }
 
 /* Setters and getters for task parameters */
 void task_set_period(int i, int per)
 {
-    tp[i].period = per;
+    tp[i].period = per * 1000L;
 }
 
 void task_set_deadline(int i, int drel)
 {
-    tp[i].deadline = drel;
+    tp[i].deadline = drel * 1000L;
+}
+
+void task_set_period_us(int i, long per_us)
+{
+    tp[i].period = per_us;
+}
+
+void task_set_deadline_us(int i, long drel_us)
+{
+    tp[i].deadline = drel_us;
+}
+
+/* Only read when the task starts: call it between ptask_init() and task_create() */
+void task_set_runtime_us(int i, long runtime_us)
+{
+    tp[i].runtime = runtime_us;
+}
+
+int task_policy(int i)
+{
+    return tp[i].policy;
+}
+
+/*
+ * Locks the memory of the process and prepares the heap for the tasks:
+ * one arena for every thread, freed blocks kept (no trim, no mmap), and
+ * heap_bytes allocated and written once. The heap is prepared even if
+ * mlockall() is refused (RLIMIT_MEMLOCK, no privileges).
+ */
+int ptask_lock_memory(size_t heap_bytes)
+{
+    char *heap;
+    int ret = 0;
+
+    mallopt(M_ARENA_MAX, 1);
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        fprintf(stderr, "ptask: mlockall: %s, memory not locked\n", strerror(errno));
+        ret = -1;
+    }
+
+    if (heap_bytes > 0 && (heap = malloc(heap_bytes)) != NULL) {
+        memset(heap, 0, heap_bytes);
+        free(heap);
+    }
+    ptask_count_faults(1);
+    return ret;
+}
+
+void ptask_count_faults(int on)
+{
+    ptask_faults_on = on;
+}
+
+/* Only read by task_create(): call them between ptask_init() and task_create() */
+void task_set_stack_size(int i, size_t bytes)
+{
+    tp[i].stack_size = bytes;
+}
+
+void task_set_warmup(int i, void (*warmup)(void))
+{
+    tp[i].warmup = warmup;
+}
+
+int task_precedence(int from, int to, int type)
+{
+    if (from < 0 || from >= MAX_TASKS || to < 0 || to >= MAX_TASKS || from == to ||
+        tp[from].n_succ == PTASK_MAX_SUCCESSORS)
+        return -1;
+    tp[from].succ[tp[from].n_succ] = to;
+    tp[from].succ_type[tp[from].n_succ] = type;
+    tp[from].n_succ++;
+    tp[to].n_pred++;
+    if (type == PTASK_EDGE_TRIGGER)
+        tp[to].triggered = 1;
+    return 0;
+}
+
+void task_set_e2e_deadline_us(int i, long e2e_us)
+{
+    tp[i].e2e_deadline = e2e_us;
+}
+
+void task_set_budget_us(int i, long budget_us, int mode)
+{
+    tp[i].budget = budget_us;
+    tp[i].budget_mode = mode;
+}
+
+int ptask_budget_exhausted(void)
+{
+    return ptask_self >= 0 && tp[ptask_self].exhausted > 0 && tp[ptask_self].policy != SCHED_DEADLINE;
+}
+
+int cyclic_job(int i, void (*job)(void), long period_us, long drel_us, long wcet_us)
+{
+    int k;
+
+    if (i < 0 || i >= MAX_TASKS || job == NULL || period_us <= 0 || wcet_us <= 0 || tp[i].job != NULL)
+        return -1;
+    tp[i].job = job;
+    tp[i].wcet = wcet_us;
+    tp[i].period = period_us;
+    tp[i].deadline = drel_us;
+    tp[i].policy = PTASK_SCHED_CYCLIC;
+    tp[i].stack_size = 0;   /* no thread, no budget timer */
+    tp[i].budget = 0;
+    tp[i].dmiss = 0;
+    task_reset_stats(i);
+
+    /* Insertion by deadline, ties by index */
+    for (k = ptask_cyclic.n; k > 0; k--) {
+        int j = ptask_cyclic.order[k - 1];
+        if (tp[j].deadline < drel_us || (tp[j].deadline == drel_us && j < i))
+            break;
+        ptask_cyclic.order[k] = j;
+    }
+    ptask_cyclic.order[k] = i;
+    ptask_cyclic.n++;
+    return 0;
+}
+
+static long ptask_gcd(long a, long b)
+{
+    while (b != 0) {
+        long r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+/* WCET of a cyclic job with the cyclic jobs it triggers, run after it in the same frame */
+static long ptask_cyclic_wcet(int i)
+{
+    long wcet = tp[i].wcet;
+    int k;
+
+    for (k = 0; k < tp[i].n_succ; k++)
+        if (tp[tp[i].succ[k]].job != NULL)
+            wcet += ptask_cyclic_wcet(tp[i].succ[k]);
+    return wcet;
+}
+
+/* Frame table of the time-triggered jobs: a triggered job runs after the job activating it */
+long cyclic_build(void)
+{
+    long minor = 0, hyper = 1, load;
+    int k, f, i;
+
+    for (k = 0; k < ptask_cyclic.n; k++) {
+        i = ptask_cyclic.order[k];
+        if (tp[i].triggered)
+            continue;
+        minor = ptask_gcd(minor, tp[i].period);
+        hyper = hyper / ptask_gcd(hyper, tp[i].period) * tp[i].period;
+        if (hyper / minor > PTASK_CYCLIC_MAX_FRAMES)
+            return 0;
+    }
+    if (minor == 0 || hyper % minor != 0)
+        return 0;
+
+    /* Every frame must hold the jobs released in it */
+    for (f = 0; f < hyper / minor; f++) {
+        load = 0;
+        for (k = 0; k < ptask_cyclic.n; k++) {
+            i = ptask_cyclic.order[k];
+            if (!tp[i].triggered && (f * minor) % tp[i].period == 0)
+                load += ptask_cyclic_wcet(i);
+        }
+        if (load > minor)
+            return 0;
+    }
+
+    free(ptask_cyclic.table);
+    ptask_cyclic.frames = (int)(hyper / minor);
+    ptask_cyclic.frame = 0;
+    ptask_cyclic.table = calloc(ptask_cyclic.frames, sizeof(uint32_t));
+    if (ptask_cyclic.table == NULL)
+        return 0;
+    for (f = 0; f < ptask_cyclic.frames; f++)
+        for (k = 0; k < ptask_cyclic.n; k++) {
+            i = ptask_cyclic.order[k];
+            if (!tp[i].triggered && (f * minor) % tp[i].period == 0)
+                ptask_cyclic.table[f] |= 1u << k;
+        }
+    return minor;
 }
 
+int cyclic_frames(void)
+{
+    return ptask_cyclic.frames;
+}
+
+/* One job of cyclic task i, released at tp[i].rt, then the jobs it triggers */
+static void ptask_cyclic_run(int i)
+{
+    int k, s;
+
+    tp[i].dl = tp[i].rt;
+    time_add_us(&tp[i].dl, tp[i].deadline);
+    ptask_job_start(i);
+    tp[i].job();
+    ptask_job_end(i);
+
+    for (k = 0; k < tp[i].n_succ; k++) {
+        s = tp[i].succ[k];
+        while (tp[s].job != NULL && tp[s].pending > 0) {
+            tp[s].pending--;
+            ptask_pop_activation(s);
+            ptask_cyclic_run(s);
+        }
+    }
+}
+
+/* Jobs of the current frame, released at the release of the executive job */
+void cyclic_frame(int e)
+{
+    uint32_t released = ptask_cyclic.table[ptask_cyclic.frame];
+    int k, i;
+
+    for (k = 0; k < ptask_cyclic.n; k++) {
+        if (!(released & (1u << k)))
+            continue;
+        i = ptask_cyclic.order[k];
+        tp[i].rt = tp[e].rt;
+        ptask_cyclic_run(i);
+    }
+    ptask_cyclic.frame = (ptask_cyclic.frame + 1) % ptask_cyclic.frames;
+}
+
+size_t task_stack_size(int i)
+{
+    return tp[i].stack != NULL || tp[i].stack_peak > 0 ? tp[i].stack_size : 0;
+}
+
+size_t task_stack_peak(int i)
+{
+    return tp[i].stack != NULL ? ptask_scan_stack(i) : tp[i].stack_peak;
+}
+
+void task_set_affinity(int i, const cpu_set_t *cpus)
+{
+    tp[i].pinned = (cpus != NULL);
+    if (cpus != NULL)
+        tp[i].cpus = *cpus;
+}
+
+int task_get_affinity(int i, cpu_set_t *cpus)
+{
+    if (tp[i].job != NULL)
+        return ESRCH;
+    return pthread_getaffinity_np(tp[i].tid, sizeof(cpu_set_t), cpus);
+}
+
+/* Parses the CPU list of the kernel ("1-3,6"), empty without isolcpus= */
+int ptask_isolated_cpus(cpu_set_t *cpus)
+{
+    FILE *f;
+    int first, last, cpu, sep, n = 0;
+
+    CPU_ZERO(cpus);
+    f = fopen("/sys/devices/system/cpu/isolated", "r");
+    if (f == NULL)
+        return 0;
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        sep = fgetc(f);
+        if (sep == '-' && fscanf(f, "%d", &last) == 1)
+            sep = fgetc(f);
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++, n++)
+            CPU_SET(cpu, cpus);
+        if (sep != ',')
+            break;
+    }
+    fclose(f);
+    return n;
+}
+
+const char *ptask_policy_name(int policy)
+{
+    switch (policy) {
+        case SCHED_OTHER:    return "SCHED_OTHER";
+        case SCHED_FIFO:     return "SCHED_FIFO";
+        case SCHED_RR:       return "SCHED_RR";
+        case SCHED_DEADLINE: return "SCHED_DEADLINE";
+        case PTASK_SCHED_RM: return "SCHED_FIFO (RM)";
+        case PTASK_SCHED_CYCLIC: return "cyclic executive";
+        default:             return "unknown";
+    }
+}
+
+/* Period and deadline in milliseconds (truncated) */
 int task_period(int i)
 {
-    return tp[i].period;
+    return tp[i].period / 1000;
 }
 
 int task_deadline(int i)
+{
+    return tp[i].deadline / 1000;
+}
+
+long task_period_us(int i)
+{
+    return tp[i].period;
+}
+
+long task_deadline_us(int i)
 {
     return tp[i].deadline;
 }
@@ -337,12 +1600,155 @@ void task_adline(int i, timespec_custom *dl)
     dl->tv_nsec = tp[i].dl.tv_nsec;
 }
 
+/*
+ * Copies the statistics of task i. Can be called from any thread while the
+ * task runs: the copy is retried if the task ended a job meanwhile.
+ */
+void task_get_stats(int i, task_stats *stats)
+{
+    unsigned int seq;
+
+    do {
+        seq = __atomic_load_n(&tp[i].seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        memcpy(stats, &tp[i].stats, sizeof(task_stats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&tp[i].seq, __ATOMIC_RELAXED) != seq);
+}
+
+void task_reset_stats(int i)
+{
+    __atomic_store_n(&tp[i].seq, tp[i].seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset(&tp[i].stats, 0, sizeof(task_stats));
+    __atomic_store_n(&tp[i].seq, tp[i].seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Value below which p percent of the samples are (0 < p <= 100), to the
+ * resolution of the histogram, never above the maximum. 0 without samples.
+ */
+long ptask_metric_percentile(const ptask_metric *m, double p)
+{
+    unsigned long rank, seen = 0;
+    int b;
+
+    if (m->count == 0)
+        return 0;
+    rank = (unsigned long)(p / 100.0 * m->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (b = 0; b < PTASK_HIST_BUCKETS; b++) {
+        seen += m->hist[b];
+        if (seen >= rank)
+            return ptask_hist_upper(b) < m->max ? ptask_hist_upper(b) : m->max;
+    }
+    return m->max;
+}
+
+/* Prints the statistics of task i as [name],KEY,value rows, times in microseconds */
+void task_print_stats(int i, const char *name)
+{
+    static const char *metric_names[PTASK_N_METRICS] = { "LATENCY", "RESPONSE", "EXEC", "E2E" };
+    task_stats s;
+    int k;
+
+    task_get_stats(i, &s);
+    printf("[%s],JOBS,%lu\n", name, s.jobs);
+    printf("[%s],DMISS,%lu\n", name, s.dmiss);
+    if (ptask_faults_on)
+        printf("[%s],PAGE_FAULTS,%lu\n", name, s.faults);
+    if (tp[i].warmup != NULL)
+        printf("[%s],WARMUP_FAULTS,%lu\n", name, s.warmup_faults);
+    if (task_stack_size(i) > 0) {
+        printf("[%s],STACK_SIZE_KB,%zu\n", name, task_stack_size(i) / 1024);
+        printf("[%s],STACK_PEAK_KB,%.1f\n", name, task_stack_peak(i) / 1024.0);
+    }
+    if (s.jobs == 0)
+        return;
+    if (s.metric[PTASK_E2E].count > 0)
+        printf("[%s],E2E_MISS,%lu\n", name, s.e2e_miss);
+    if (tp[i].budget > 0) {
+        printf("[%s],BUDGET_US,%ld\n", name, tp[i].budget);
+        printf("[%s],BUDGET_OVERRUNS,%lu\n", name, s.overruns);
+        printf("[%s],BUDGET_POSTPONED,%lu\n", name, s.postponed);
+        printf("[%s],BUDGET_USED_P99_PCT,%.1f\n", name,
+               ptask_metric_percentile(&s.metric[PTASK_EXEC], 99.0) * 0.1 / tp[i].budget);
+    }
+    for (k = 0; k < PTASK_N_METRICS; k++) {
+        const ptask_metric *m = &s.metric[k];
+        if (m->count == 0)
+            continue;
+        printf("[%s],%s_MIN_US,%.1f\n", name, metric_names[k], m->min * 1e-3);
+        printf("[%s],%s_MEAN_US,%.1f\n", name, metric_names[k], (double)m->sum / m->count * 1e-3);
+        printf("[%s],%s_P99_US,%.1f\n", name, metric_names[k], ptask_metric_percentile(m, 99.0) * 1e-3);
+        printf("[%s],%s_MAX_US,%.1f\n", name, metric_names[k], m->max * 1e-3);
+    }
+}
+
 /*
  * Waits for the given task to complete (join its thread).
  */
 void wait_for_task_end(int i)
 {
+    if (tp[i].job != NULL)
+        return;
     pthread_join(tp[i].tid, NULL);
+    if (tp[i].budget_timer_ok) {
+        timer_delete(tp[i].budget_timer);
+        tp[i].budget_timer_ok = 0;
+    }
+    ptask_free_stack(i);
+}
+
+/*
+ * sem_wait() for tasks. On the virtual clock a task waiting for the
+ * semaphore gives the CPU to the others instead of holding it. The budget
+ * signal interrupts sem_wait() even with SA_RESTART: it is restarted here.
+ */
+void task_sem_wait(sem_t *s)
+{
+    int i = ptask_self;
+
+    if (ptask_clock != PTASK_CLOCK_VIRTUAL || i < 0) {
+        while (sem_wait(s) != 0 && errno == EINTR)
+            ;
+        return;
+    }
+
+    pthread_mutex_lock(&vc_mutex);
+    if (sem_trywait(s) != 0) {
+        vc_task[i].state = VC_EVENT;
+        vc_task[i].event = s;
+        vc_wait_cpu(i);
+    }
+    pthread_mutex_unlock(&vc_mutex);
+}
+
+/*
+ * sem_post() for tasks. On the virtual clock the unit goes directly to the
+ * highest-priority task waiting for it, which runs after the poster blocks.
+ */
+void task_sem_post(sem_t *s)
+{
+    int i, waiter = -1;
+
+    if (ptask_clock != PTASK_CLOCK_VIRTUAL) {
+        sem_post(s);
+        return;
+    }
+
+    pthread_mutex_lock(&vc_mutex);
+    for (i = 0; i < MAX_TASKS; i++)
+        if (vc_task[i].state == VC_EVENT && vc_task[i].event == s &&
+            (waiter < 0 || tp[i].prio > tp[waiter].prio))
+            waiter = i;
+    if (waiter >= 0)
+        vc_task[waiter].state = VC_READY;
+    else
+        sem_post(s);
+    pthread_mutex_unlock(&vc_mutex);
 }
 
 #endif /* PTASK_IMPLEMENTATION */
@@ -0,0 +1,33 @@
+#ifndef RACELINE_H
+#define RACELINE_H
+
+#include "globals.h"
+#include "perception.h"
+#include "trajectory.h"
+
+#define MAX_RACELINE_POINTS	MAX_DETECTED_CONES
+
+#define RACELINE_MARGIN		0.15f	// minimum lateral distance kept from the cones [m]
+#define RACELINE_MIN_SPACING	0.05f	// centerline points closer than this are merged [m]
+#define RACELINE_RHO		1.0f	// ADMM penalty parameter
+#define RACELINE_MAX_ITER	300		// ADMM iterations per call (the solve resumes on the next call)
+#define RACELINE_TOL		1e-4f	// primal/dual residual tolerance [m]
+
+typedef struct {
+	int		n_solves;			// number of published solutions
+	int		n_points;			// points of the last solution
+	int		closed;				// 1 if the last solution is a closed lap
+	int		converged;			// 1 if the last solution met RACELINE_TOL
+	int		last_iterations;	// ADMM iterations spent on the last solution
+	long	last_solve_us;		// time spent on the last solution (factorization included)
+} raceline_stats_t;
+
+// Background optimization (called by the raceline task only); the problem is
+// rebuilt when track_map_idx or map_version (see sim_context) changes
+void	raceline_optimize(cone *track_map, int track_map_idx, int map_version);
+
+// Non-blocking readers: return -1 if the optimizer is publishing right now
+int		raceline_get(waypoint *raceline, int max_points);
+int		raceline_get_stats(raceline_stats_t *stats);
+
+#endif // RACELINE_H
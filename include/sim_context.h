@@ -0,0 +1,76 @@
+#ifndef SIM_CONTEXT_H
+#define SIM_CONTEXT_H
+
+#include "globals.h"
+#include "perception.h"
+#include "trajectory.h"
+#include "boundaries.h"
+#include "vehicle.h"
+#include "velocity.h"
+#include "control.h"
+#include "mpc.h"
+
+/*
+	State of one perception -> planning -> control pipeline, passed to lidar(),
+	mapping(), update_map(), trajectory_planning(), velocity_profile(), the
+	controllers and vehicle_model(). Still process-wide: the boundary graph
+	and the published trajectory snapshot (reset by sim_modules_reset()),
+	the racing line, the lattice planner and the car pose (car_x, car_y,
+	car_angle, passed to the functions above).
+	The tasks run default_context; measures, detected_cones, track_map,
+	trajectory and speed_profile are kept as aliases of its arrays.
+*/
+struct sim_context {
+	/* Perception */
+	pointcloud_t	measures[MAX_DETECTED_CONES];		// last LiDAR scan, indexed by angle
+	cone			detected_cones[MAX_DETECTED_CONES];	// cones of the last scan, ended by color -1
+	candidate_cone	candidates[MAX_CANDIDATES];			// cones seen fewer than detections_threshold times
+	int				n_candidates;
+	cone			track_map[MAX_CONES_MAP];			// append-only
+	int				track_map_idx;
+	int				map_version;						// new on every sim_context_init() (map reload)
+
+	/* Planning */
+	waypoint		trajectory[2*MAX_DETECTED_CONES];	// ended by a (-1, -1) sentinel
+	int				trajectory_idx;
+	velocity_profile_t	velocity;						// speed profile of trajectory
+	track_boundaries	boundaries;						// copy of the published boundaries, refreshed on a new version
+
+	/* Control */
+	float			pedal;			// [-1 -> 1]
+	float			steering;		// [rad]
+	int				controller_idx;	// controller of the last step, -1 before the first (see controller.c)
+	pursuit_state_t	pursuit;		// nearest waypoint hint
+	mpc_state_t		mpc;			// warm start
+
+	/* Vehicle model */
+	vehicle_state	vehicle;
+	int				vehicle_synced;	// the pose passed to vehicle_model() was written by it
+	float			last_x, last_y;
+	int				last_angle;
+
+	int				warmup;		// copy run by a warm-up (see tasks.c): no statistics or module state written
+};
+
+extern sim_context	default_context;
+
+/* Legacy globals of the default pipeline, for code written before the context:
+   define SIM_CONTEXT_LEGACY before the includes (the names become macros, so such
+   a file cannot use the members of the same name on a context) */
+#ifdef SIM_CONTEXT_LEGACY
+#define n_candidates	(default_context.n_candidates)
+#define track_map_idx	(default_context.track_map_idx)
+#define trajectory_idx	(default_context.trajectory_idx)
+#define pedal			(default_context.pedal)
+#define steering		(default_context.steering)
+#endif /* SIM_CONTEXT_LEGACY */
+
+// Empty map and trajectory, car at rest, no cached profile or controller state; touches
+// nothing outside ctx (the context is large: allocate it statically or with malloc)
+void	sim_context_init(sim_context *ctx);
+
+// Process-wide state listed above, except the car pose, set by the caller: empty
+// boundary graph, no published plan. No task may be running
+void	sim_modules_reset();
+
+#endif // SIM_CONTEXT_H
@@ -1,13 +1,53 @@
 #ifndef TASKS_H
 #define TASKS_H
 
-#include "utilities.h"  // For runtime
 #include "control.h"    // For keyboard_control and autonomous_control
 #include "display.h"    // For draw_trajectory
+#include "ptask.h"      // For timespec_custom
+
+// One job of each task (no waiting, no synchronization)
+void perception_job();
+void trajectory_job(timespec_custom *deadline);	// planning stops at the deadline
+void control_job(int autonomous);				// keyboard unless autonomous
+void raceline_job();
+
+// ptask index of each task, for the trace and the job statistics (EXECUTIVE_TASK: cyclic executive only)
+enum { EXECUTIVE_TASK, PERCEPTION_TASK, TRAJECTORY_TASK, CONTROL_TASK, DISPLAY_TASK, RACELINE_TASK, N_SIM_TASKS };
+extern const char *const task_names[N_SIM_TASKS];
+
+// Pins the tasks (before task_create()) to the given CPUs: CONTROL (or EXECUTIVE) alone on the first one,
+// the others one CPU each, round robin over the rest. Returns the number of CPUs used
+int  pin_tasks(const cpu_set_t *cpus);
+void print_placement();	// CPUs each running task may use
+
+// Before task_create(): perception -> trajectory -> control. TRAJECTORY is activated by the
+// end of each perception job (create it DEACT), CONTROL samples the last plan at its period
+void connect_tasks();
+
+// Before task_create(): CPU budgets (constant bandwidth servers of ptask). Perception stops
+// its scan early when out of budget, raceline runs below the other tasks until its job ends
+void set_task_budgets();
+
+// Before task_create(): stacks of known size, filled with the canary of ptask (peak usage
+// reported at exit), and for the real-time start-up one warm-up pass per task on a copy
+// of the pipeline (see tasks.c; none for raceline)
+void set_task_stacks();
+void prepare_tasks_realtime();
+
+// Cyclic executive, after connect_tasks() and set_task_stacks(): control becomes a job of
+// EXECUTIVE_TASK, to create with executive_task and the returned minor frame [us] as period
+// (0: no table). Perception, trajectory and display do not fit the frame: create them as threads
+long setup_cyclic_executive();
 
 void *perception_task(void *arg);
 void *trajectory_task(void *arg);
 void *control_task(void *arg);
 void *display_task(void *arg);
+void *raceline_task(void *arg);
+void *executive_task(void *arg);
+
+#ifdef JITTER_MEASUREMENT
+void print_control_jitter();
+#endif /* JITTER_MEASUREMENT */
 
 #endif // TASKS_H
\ No newline at end of file
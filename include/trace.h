@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "ptask.h"
+
+/*
+	Job tracing: each traced task writes binary records in its own preallocated
+	single-producer ring (no lock, no syscall besides the clock read); a drain
+	thread at the lowest priority appends them to the trace file.
+	A full ring drops the record (counted) instead of blocking the task.
+
+	File: trace_header_t, then trace_record_t records in drain order
+	(ordered by time within each task). Read by profiler/gantt.py.
+	A path ending in ".json" gets Chrome trace-event JSON instead (one track
+	per task, times in us from ptask_t0, the time 0 set by ptask_init()),
+	for chrome://tracing or Perfetto.
+*/
+#define TRACE_FILE				"profiler/trace.bin"
+#define TRACE_RING_RECORDS		8192	// per task, power of two
+#define TRACE_DRAIN_PERIOD_US	10000
+#define TRACE_NAME_LENGTH		16
+#define TRACE_MAX_LABELS		8		// names referred to by the arg of some events
+
+#define TRACE_MAGIC				"PTTRACE2"
+
+enum {
+	TRACE_JOB_START,
+	TRACE_JOB_END,
+	TRACE_DEADLINE_MISS,	// recorded with the end of a job that finished after its deadline
+	TRACE_MAP_UPDATE,		// arg: cones in the map
+	TRACE_MPC_SOLVE,		// value: QP iterations, solve time [us]
+	TRACE_OVERRUN			// arg: label of the controller, value: CPU time, budget [us]
+};
+
+typedef struct {
+	char		magic[8];
+	uint32_t	record_size;
+	uint32_t	n_tasks;							// MAX_TASKS
+	char		names[MAX_TASKS][TRACE_NAME_LENGTH];	// "" for tasks not traced
+	uint32_t	n_labels;							// TRACE_MAX_LABELS
+	char		labels[TRACE_MAX_LABELS][TRACE_NAME_LENGTH];	// "" if not set
+} trace_header_t;
+
+typedef struct {
+	uint64_t	time_ns;	// ptask_gettime(): monotonic or virtual clock
+	uint32_t	job;		// job number of the task, from 1
+	uint8_t		task;		// ptask index
+	uint8_t		event;		// TRACE_JOB_START, ...
+	uint16_t	arg;		// event dependent, 0 if unused
+	uint32_t	value[2];	// event dependent, 0 if unused
+} trace_record_t;
+
+// Setup, before the tasks are created: output file, then one ring per traced task
+int		trace_open(const char *path);
+int		trace_add_task(int task, const char *name);
+int		trace_add_label(int label, const char *name);	// any time before trace_start()
+void	trace_start();	// writes the header, starts the drain thread
+void	trace_close();	// after the tasks ended: drains everything, reports drops
+
+// Producers: only the thread of the task (no-op if the task is not traced)
+void	trace_job_start(int task);
+void	trace_job_end(int task);	// also records a deadline miss
+
+// From the code run by a job, which does not know its task: the task of the calling thread
+void	trace_map_update(int cones);
+void	trace_mpc_solve(int iterations, long solve_us);
+void	trace_overrun(int controller_label, long cpu_us, long budget_us);
+
+#endif // TRACE_H
@@ -3,15 +3,55 @@
 
 #include "perception.h"
 #include "globals.h"
+#include "ptask.h"
 
 typedef struct {
 	float x;
 	float y;
 } waypoint;
 
-extern waypoint trajectory[2*MAX_DETECTED_CONES];
-extern int trajectory_idx;
+#define CENTERLINE_MERGE_DISTANCE 0.001f // midpoints closer than this are merged [m]
 
-void trajectory_planning(float car_x, float car_y, float car_angle, cone *detected_cones, waypoint *trajectory);
+#define PLANNER_COARSE_RADIUS		3.0f	// cones around the car used by the coarse stage [m]
+#define PLANNER_MAX_SMOOTH_ITERS	50
+#define PLANNER_SMOOTH_WEIGHT		0.25f
+#define PLANNER_SMOOTH_TOL			0.005f	// smoothing stops when no point moves more than this [m]
+#define PLANNER_CORRIDOR_MARGIN		0.3f	// smoothed points stay this far from the boundaries [m]
+
+/* Anytime planner stages, in order; the last one reached is published */
+#define PLANNER_STAGE_COARSE	0	// centerline of the cones around the car
+#define PLANNER_STAGE_FULL		1	// centerline of the whole map
+#define PLANNER_STAGE_SMOOTH	2	// smoothed full centerline
+#define PLANNER_N_STAGES		3
+
+typedef struct {
+	long	jobs;
+	long	deadline_cuts;						// jobs stopped by the safety margin
+	long	smooth_iterations;
+	long	stage_count[PLANNER_N_STAGES];		// jobs that reached each stage
+	long	stage_time_us[PLANNER_N_STAGES];	// cumulated time from job start to the end of the stage
+	long	stage_max_us[PLANNER_N_STAGES];
+} planner_stats_t;
+
+/* Last complete plan, as seen by the controller */
+typedef struct {
+	int			version;							// 0 = nothing published yet
+	int			n_points;
+	waypoint	points[2*MAX_DETECTED_CONES];
+	float		speed[2*MAX_DETECTED_CONES];		// speed profile at each point [m/s]
+} trajectory_snapshot_t;
+
+extern waypoint *const trajectory;	// default_context.trajectory (default_context.trajectory_idx points)
+
+int  build_centerline(cone *track_map, int track_map_idx, waypoint *centerline);
+// Plans on ctx->track_map into ctx->trajectory
+void trajectory_planning(sim_context *ctx, float car_x, float car_y, float car_angle, timespec_custom *deadline);
+void trajectory_get_stats(planner_stats_t *stats);
+void trajectory_print_stats();
+
+// Writer (trajectory task): publishes the finished plan with its speed profile
+void trajectory_publish_snapshot(waypoint *trajectory, int n_points, float *speed);
+// Reader (control task): never blocks, copies only a newer snapshot; returns 1 if updated
+int  trajectory_get_snapshot(trajectory_snapshot_t *snapshot);
 
 #endif // TRAJECTORY_H
\ No newline at end of file
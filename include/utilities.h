@@ -7,6 +7,5 @@
 void	init_cones(cone *cones);
 void	load_cones_positions(const char *filename, cone *cones, int max_cones);
 float	angle_rotation_sprite(float angle);
-void	runtime(int stop_signal, char* task_name);
 
 #endif // UTILITIES_H
\ No newline at end of file
@@ -1,6 +1,49 @@
 #ifndef VEHICLE_H
 #define VEHICLE_H
 
-void vehicle_model(float *car_x, float *car_y, int *car_angle, float pedal, float steering);
+#include "globals.h"
 
-#endif // VEHICLE_H
\ No newline at end of file
+#define VEHICLE_MAX_SPEED	1.0f	// speed reached at full pedal [m/s]
+#define SIM_TIME_SCALE		10.0f	// simulated seconds per real second
+#define VEHICLE_DT			(SIM_TIME_SCALE * CONTROL_PERIOD_US / 1e6f)	// time simulated by one vehicle_model() call, one per control job [s]
+#define VEHICLE_RK4_RATE	1000.0f	// internal RK4 steps per simulated second
+
+/* Chassis (scaled to the track: ~0.9 m wide, corners down to ~1 m radius) */
+#define VEHICLE_MASS		100.0f	// [kg]
+#define VEHICLE_LF			0.2f	// CoG to front axle [m]
+#define VEHICLE_LR			0.2f	// CoG to rear axle [m]
+#define VEHICLE_WHEELBASE	(VEHICLE_LF + VEHICLE_LR)
+#define VEHICLE_IZ			(VEHICLE_MASS * VEHICLE_LF * VEHICLE_LR)	// yaw inertia [kg m^2]
+#define VEHICLE_MAX_STEERING	(30 * deg2rad)
+
+/* Longitudinal: drive force VEHICLE_DRIVE_GAIN * (pedal * VEHICLE_MAX_SPEED - vx), brake force pedal * VEHICLE_MAX_BRAKING * vx */
+#define VEHICLE_DRIVE_GAIN	1.0f	// [N s/m]
+#define VEHICLE_MAX_BRAKING	50.0f	// [N s/m]
+
+/* Simplified Pacejka lateral force: D sin(C atan(B alpha)), D = mu * normal load */
+#define TIRE_B				10.0f
+#define TIRE_C				1.3f
+#define TIRE_MU				1.0f
+#define GRAVITY				9.81f
+
+/* Below BLEND_LOW the slip angles are ill-defined: kinematic model, dynamic above BLEND_HIGH */
+#define VEHICLE_BLEND_LOW	0.05f	// [m/s]
+#define VEHICLE_BLEND_HIGH	0.15f	// [m/s]
+
+typedef struct {
+	float	x, y;		// position of the CoG [m], y axis pointing down
+	float	yaw;		// heading [rad], same convention as car_angle
+	float	vx, vy;		// body-frame velocity, vy positive to the left [m/s]
+	float	r;			// yaw rate, positive to the left [rad/s]
+} vehicle_state;
+
+// Advances state by dt with fixed RK4 steps of 1 / VEHICLE_RK4_RATE
+void	vehicle_step(vehicle_state *state, float pedal, float steering, float dt);
+
+// Steps the simulated car of ctx by VEHICLE_DT; car_x, car_y, car_angle mirror the state
+// (and reset it when changed from outside)
+void	vehicle_model(sim_context *ctx, float *car_x, float *car_y, int *car_angle, float pedal, float steering);
+float	vehicle_speed(const sim_context *ctx);	// current longitudinal speed [m/s]
+float	vehicle_yaw(const sim_context *ctx, int car_angle);	// heading without the rounding of car_angle (if it was not changed from outside) [rad]
+
+#endif // VEHICLE_H
@@ -0,0 +1,36 @@
+#ifndef VEHICLE_BATCH_H
+#define VEHICLE_BATCH_H
+
+#include "globals.h"
+#include "vehicle.h"
+
+/* Structure-of-arrays batch of vehicle_model() cars, stepped VEHICLE_BATCH_LANES at a time */
+#ifdef __AVX__
+#define VEHICLE_BATCH_LANES		8		// floats per vector register
+#else
+#define VEHICLE_BATCH_LANES		4		// SSE2, always available on x86-64
+#endif
+#define VEHICLE_BATCH_MAX		4096	// multiple of VEHICLE_BATCH_LANES
+#define VEHICLE_BATCH_TOLERANCE	1e-3f	// max position/heading deviation from vehicle_step() after 1 s [m, rad]
+
+#define VEHICLE_BATCH_ALIGN		__attribute__((aligned(4 * VEHICLE_BATCH_LANES)))
+
+typedef struct {
+	int		n;			// cars in use; lanes in [n, padded size) are stepped but ignored
+	float	x[VEHICLE_BATCH_MAX] VEHICLE_BATCH_ALIGN;
+	float	y[VEHICLE_BATCH_MAX] VEHICLE_BATCH_ALIGN;
+	float	yaw[VEHICLE_BATCH_MAX] VEHICLE_BATCH_ALIGN;
+	float	vx[VEHICLE_BATCH_MAX] VEHICLE_BATCH_ALIGN;
+	float	vy[VEHICLE_BATCH_MAX] VEHICLE_BATCH_ALIGN;
+	float	r[VEHICLE_BATCH_MAX] VEHICLE_BATCH_ALIGN;
+} vehicle_batch;
+
+// Sets n cars (at most VEHICLE_BATCH_MAX) to the same state
+void	vehicle_batch_init(vehicle_batch *batch, int n, const vehicle_state *state);
+void	vehicle_batch_set(vehicle_batch *batch, int i, const vehicle_state *state);
+void	vehicle_batch_get(const vehicle_batch *batch, int i, vehicle_state *state);
+
+// vehicle_step() on every car, car i with pedal[i] and steering[i] (arrays of batch->n)
+void	vehicle_batch_step(vehicle_batch *batch, const float *pedal, const float *steering, float dt);
+
+#endif // VEHICLE_BATCH_H
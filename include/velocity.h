@@ -0,0 +1,31 @@
+#ifndef VELOCITY_H
+#define VELOCITY_H
+
+#include "trajectory.h"
+
+#define MAX_LATERAL_ACCEL	0.5f	// [m/s^2]
+#define MAX_LONG_ACCEL		0.3f	// [m/s^2]
+#define MAX_LONG_DECEL		0.6f	// [m/s^2]
+#define PROFILE_EPSILON		1e-4f	// path points closer than this are considered unchanged [m]
+#define PROFILE_LOOP_DISTANCE	0.5f	// a path ending this close to its start is a closed lap [m]
+#define PROFILE_SPEED_EPSILON	0.05f	// start speeds closer than this keep the cached profile [m/s]
+
+/* Speed profile of the plan of one pipeline (see sim_context.h), with the last
+   profiled path so that only the changed section is recomputed */
+typedef struct {
+	float		speed[2*MAX_DETECTED_CONES];	// target speed at each trajectory point [m/s]
+	waypoint	path[2*MAX_DETECTED_CONES];		// last profiled path
+	int			n_points;						// 0: nothing cached
+	float		start_speed;
+	float		limit[2*MAX_DETECTED_CONES];	// curvature limit at each point
+	float		forward[2*MAX_DETECTED_CONES];	// result of the forward (acceleration) pass
+} velocity_profile_t;
+
+extern float *const speed_profile;	// default_context.velocity.speed
+
+// Curvature-limited forward-backward profile of ctx->trajectory, in ctx->velocity.speed,
+// from the current speed of the car (first point), stopping at the end of an open path
+// (end of the mapped track); returns the number of recomputed points
+int velocity_profile(sim_context *ctx, float start_speed);
+
+#endif // VELOCITY_H
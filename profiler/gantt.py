@@ -1,37 +1,88 @@
 import csv
+import os
+import struct
+import sys
 import matplotlib
 matplotlib.use('TkAgg')
 import matplotlib.pyplot as plt
 import numpy as np
 import statistics
 
-def read_intervals(csv_file):
-    # Read all rows and compute a baseline (first time)
-    with open(csv_file, 'r') as f:
-        reader = list(csv.reader(f))
-        if not reader:
-            return []
-        # Use the third field from the first row as baseline
-        baseline = float(reader[0][2])
-    
+# Binary job trace written by src/trace.c (layout in include/trace.h)
+TRACE_MAGIC = b"PTTRACE2"
+TRACE_NAME_LENGTH = 16
+TRACE_RECORD = struct.Struct('<QIBBHII')  # time_ns, job, task, event, arg, value[2]
+TRACE_JOB_START, TRACE_JOB_END = 0, 1
+TRACE_OVERRUN = 5
+
+def read_trace(trace_file):
+    with open(trace_file, 'rb') as f:
+        data = f.read()
+
+    magic, record_size, n_tasks = struct.unpack_from('<8sII', data, 0)
+    if magic != TRACE_MAGIC or record_size != TRACE_RECORD.size:
+        raise ValueError(f"{trace_file}: not a trace file")
+
+    def read_names(offset, count):
+        return [data[offset + i * TRACE_NAME_LENGTH:offset + (i + 1) * TRACE_NAME_LENGTH].split(b'\0')[0].decode()
+                for i in range(count)], offset + count * TRACE_NAME_LENGTH
+
+    names, offset = read_names(16, n_tasks)
+    n_labels, = struct.unpack_from('<I', data, offset)
+    labels, offset = read_names(offset + 4, n_labels)
+
+    end = offset + (len(data) - offset) // record_size * record_size
+    return names, labels, list(TRACE_RECORD.iter_unpack(data[offset:end]))
+
+def read_intervals(trace_file):
+    names, _, records = read_trace(trace_file)
+    if not records:
+        return []
+    # Records are in drain order: pair start and end by (task, job)
+    baseline = min(r[0] for r in records)
+
     start_times = {}
     intervals = []
-    
-    # Process rows with normalized times (in microseconds)
-    for row in reader:
-        # Skip every line that doesn't start with "["
-        if not row[0].startswith('['):
-            continue
-        task, event, t = row
-        t = float(t) - baseline  # normalized time in microseconds
-        if event == "START":
-            start_times[task] = t
-        elif event == "END":
-            start_t = start_times.pop(task, None)
+
+    for t_ns, job, task, event, *_ in records:
+        t = (t_ns - baseline) / 1000.0  # normalized time in microseconds
+        if event == TRACE_JOB_START:
+            start_times[(task, job)] = t
+        elif event == TRACE_JOB_END:
+            start_t = start_times.pop((task, job), None)
             if start_t is not None:
-                intervals.append((task, start_t, t))
+                intervals.append((f"[{names[task]}]", start_t, t))
+    intervals.sort(key=lambda interval: interval[1])
     return intervals
 
+def print_overruns(trace_file):
+    # Controller steps above their budget: label of the controller, CPU time and budget [us]
+    _, labels, records = read_trace(trace_file)
+    overruns = {}
+    for _, _, _, event, label, cpu_us, budget_us in records:
+        if event == TRACE_OVERRUN:
+            overruns.setdefault((labels[label], budget_us), []).append(cpu_us)
+    for (controller, budget_us), cpu in sorted(overruns.items()):
+        print(f"Controller {controller}: {len(cpu)} steps over the {budget_us} us budget, max {max(cpu)} us\n")
+
+def read_counters(csv_file):
+    # "[TAG],KEY,value" rows printed by the simulator (e.g. "[CONTROL],DMISS,0")
+    counters = {}
+    with open(csv_file, 'r') as f:
+        for row in csv.reader(f):
+            if len(row) != 3 or not row[0].startswith('['):
+                continue
+            counters.setdefault((row[0], row[1]), []).append(float(row[2]))
+    return counters
+
+def print_counters(counters):
+    for (task, name), values in sorted(counters.items()):
+        print(f"{task} {name}")
+        print(f"  Count: {len(values)}")
+        print(f"  Mean: {sum(values) / len(values):.2f}")
+        print(f"  99th Percentile: {np.percentile(values, 99):.2f}")
+        print(f"  Max: {max(values):.2f}\n")
+
 def compute_stats(intervals):
     # Group intervals per task.
     stats_by_task = {}
@@ -92,7 +143,14 @@ def plot_gantt(intervals):
     plt.show()
 
 if __name__ == "__main__":
-    intervals = read_intervals("runtime.csv")
+    # gantt.py [trace.bin] [runtime.csv]: job trace, and counters printed by 2D_sim on stdout
+    trace_file = sys.argv[1] if len(sys.argv) > 1 else "trace.bin"
+    csv_file = sys.argv[2] if len(sys.argv) > 2 else "runtime.csv"
+
+    intervals = read_intervals(trace_file)
+    print_overruns(trace_file)
+    if os.path.exists(csv_file):
+        print_counters(read_counters(csv_file))
     if not intervals:
         print("No intervals found.")
     else:
@@ -0,0 +1,435 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "globals.h"
+#include "perception.h"
+#include "trajectory.h"
+#include "boundaries.h"
+
+/*
+	Track boundaries from the cone map.
+
+	Every cone added to the map is linked to its nearest same-colour cones within
+	BOUNDARY_LINK_RADIUS (found through a uniform grid), keeping at most two links
+	per cone so that each connected component is a chain, and rejecting links
+	that fold back on the one a cone already has; a cone that falls between two
+	already linked cones is spliced into their link. A union-find structure
+	rejects the links that would close a cycle, unless the chain is long enough
+	to be a full lap. The largest chain of each colour is the boundary.
+
+	Linking is incremental (O(1) per cone); the ordered polylines are extracted
+	once per map version and published for the planners.
+*/
+
+#define MAX_LINK_CANDIDATES 8
+
+// ---------------- Link structure (owned by the perception task) ----------------
+static float	node_x[MAX_CONES_MAP], node_y[MAX_CONES_MAP];
+static int		node_side[MAX_CONES_MAP];		// BOUNDARY_LEFT, BOUNDARY_RIGHT or -1
+static int		node_link[MAX_CONES_MAP][2];	// neighbours along the chain (-1 if none)
+static int		uf_parent[MAX_CONES_MAP], uf_size[MAX_CONES_MAP];
+static int		n_nodes = 0;
+static int		dirty = 0;
+static int		n_publications = 0;
+
+static int		grid_head[BOUNDARY_GRID_ROWS][BOUNDARY_GRID_COLS];
+static int		grid_next[MAX_CONES_MAP];
+static int		grid_initialized = 0;
+
+static track_boundaries	staged;			// extraction buffer
+
+// ---------------- Published boundaries ----------------
+static pthread_mutex_t	boundaries_mutex = PTHREAD_MUTEX_INITIALIZER;
+static track_boundaries	published;
+
+
+static int uf_find(int i)
+{
+	while (uf_parent[i] != i)
+	{
+		uf_parent[i] = uf_parent[uf_parent[i]]; // path halving
+		i = uf_parent[i];
+	}
+	return i;
+}
+
+static void uf_union(int a, int b)
+{
+	a = uf_find(a);
+	b = uf_find(b);
+	if (a == b) return;
+	if (uf_size[a] < uf_size[b]) { int tmp = a; a = b; b = tmp; }
+	uf_parent[b] = a;
+	uf_size[a] += uf_size[b];
+}
+
+static int degree(int i)
+{
+	return (node_link[i][0] != -1) + (node_link[i][1] != -1);
+}
+
+static void add_link(int a, int b)
+{
+	node_link[a][node_link[a][0] == -1 ? 0 : 1] = b;
+	node_link[b][node_link[b][0] == -1 ? 0 : 1] = a;
+}
+
+// True if the link u-v does not fold back on the link already attached to u
+static int continues_chain(int u, int v)
+{
+	int w = node_link[u][0];
+	if (w == -1) return 1;
+	float ax = node_x[u] - node_x[w], ay = node_y[u] - node_y[w];
+	float bx = node_x[v] - node_x[u], by = node_y[v] - node_y[u];
+	return ax * bx + ay * by > BOUNDARY_MIN_TURN_COS * hypotf(ax, ay) * hypotf(bx, by);
+}
+
+static int grid_col(float x)
+{
+	int col = (int)(x / BOUNDARY_LINK_RADIUS);
+	return (col < 0) ? 0 : ((col >= BOUNDARY_GRID_COLS) ? BOUNDARY_GRID_COLS - 1 : col);
+}
+
+static int grid_row(float y)
+{
+	int row = (int)(y / BOUNDARY_LINK_RADIUS);
+	return (row < 0) ? 0 : ((row >= BOUNDARY_GRID_ROWS) ? BOUNDARY_GRID_ROWS - 1 : row);
+}
+
+static void replace_link(int a, int old_b, int new_b)
+{
+	node_link[a][node_link[a][0] == old_b ? 0 : 1] = new_b;
+}
+
+// Inserts v into an existing link u-w if it lies between the two cones; returns 1 on success
+static int splice_node(int v, int row, int col)
+{
+	int		best_u = -1, best_w = -1;
+	float	best_detour = BOUNDARY_SPLICE_DETOUR;
+
+	for (int r = row - 1; r <= row + 1; r++)
+	{
+		for (int c = col - 1; c <= col + 1; c++)
+		{
+			if (r < 0 || r >= BOUNDARY_GRID_ROWS || c < 0 || c >= BOUNDARY_GRID_COLS) continue;
+
+			for (int u = grid_head[r][c]; u != -1; u = grid_next[u])
+			{
+				if (u == v || node_side[u] != node_side[v]) continue;
+
+				for (int k = 0; k < 2; k++)
+				{
+					int w = node_link[u][k];
+					if (w == -1 || w < u) continue; // each link once
+
+					float uw = hypotf(node_x[w] - node_x[u], node_y[w] - node_y[u]);
+					float uv = hypotf(node_x[v] - node_x[u], node_y[v] - node_y[u]);
+					float vw = hypotf(node_x[w] - node_x[v], node_y[w] - node_y[v]);
+					float detour = (uv + vw) / fmaxf(uw, 1e-6f);
+
+					if (uv < BOUNDARY_LINK_RADIUS && vw < BOUNDARY_LINK_RADIUS && detour < best_detour)
+					{
+						best_detour = detour;
+						best_u = u;
+						best_w = w;
+					}
+				}
+			}
+		}
+	}
+
+	if (best_u < 0) return 0;
+
+	replace_link(best_u, best_w, v);
+	replace_link(best_w, best_u, v);
+	node_link[v][0] = best_u;
+	node_link[v][1] = best_w;
+	uf_union(best_u, v);
+	return 1;
+}
+
+static void link_node(int v)
+{
+	int		candidates[MAX_LINK_CANDIDATES];
+	float	distances[MAX_LINK_CANDIDATES];
+	int		n_candidates = 0;
+
+	int row = grid_row(node_y[v]), col = grid_col(node_x[v]);
+
+	// A cone found late between two linked cones goes into their link
+	if (splice_node(v, row, col)) return;
+
+	// Same-colour chain ends within the link radius, sorted by distance
+	for (int r = row - 1; r <= row + 1; r++)
+	{
+		for (int c = col - 1; c <= col + 1; c++)
+		{
+			if (r < 0 || r >= BOUNDARY_GRID_ROWS || c < 0 || c >= BOUNDARY_GRID_COLS) continue;
+
+			for (int u = grid_head[r][c]; u != -1; u = grid_next[u])
+			{
+				if (u == v || node_side[u] != node_side[v] || degree(u) >= 2) continue;
+
+				float dist = hypotf(node_x[u] - node_x[v], node_y[u] - node_y[v]);
+				if (dist > BOUNDARY_LINK_RADIUS) continue;
+
+				int pos = (n_candidates < MAX_LINK_CANDIDATES) ? n_candidates++ : MAX_LINK_CANDIDATES - 1;
+				if (pos == MAX_LINK_CANDIDATES - 1 && dist >= distances[pos]) continue;
+
+				while (pos > 0 && distances[pos-1] > dist)
+				{
+					candidates[pos] = candidates[pos-1];
+					distances[pos] = distances[pos-1];
+					pos--;
+				}
+				candidates[pos] = u;
+				distances[pos] = dist;
+			}
+		}
+	}
+
+	for (int k = 0; k < n_candidates && degree(v) < 2; k++)
+	{
+		int u = candidates[k];
+		if (!continues_chain(u, v) || !continues_chain(v, u)) continue;
+
+		int root_u = uf_find(u), root_v = uf_find(v);
+
+		if (root_u != root_v)
+		{
+			add_link(u, v);
+			uf_union(u, v);
+		}
+		else if (uf_size[root_u] >= BOUNDARY_MIN_LOOP)
+		{
+			add_link(u, v); // the chain closes a lap
+		}
+	}
+}
+
+void	boundaries_add_cone(cone *track_map, int cone_idx)
+{
+	if (!grid_initialized)
+	{
+		memset(grid_head, -1, sizeof(grid_head));
+		grid_initialized = 1;
+	}
+
+	// The map is append-only: process every cone up to cone_idx
+	for (; n_nodes <= cone_idx && n_nodes < MAX_CONES_MAP; n_nodes++)
+	{
+		int v = n_nodes;
+
+		node_x[v] = track_map[v].x;
+		node_y[v] = track_map[v].y;
+		node_side[v] = (track_map[v].color == blue) ? BOUNDARY_LEFT :
+						((track_map[v].color == yellow) ? BOUNDARY_RIGHT : -1);
+		node_link[v][0] = node_link[v][1] = -1;
+		uf_parent[v] = v;
+		uf_size[v] = 1;
+
+		int row = grid_row(node_y[v]), col = grid_col(node_x[v]);
+		grid_next[v] = grid_head[row][col];
+		grid_head[row][col] = v;
+
+		if (node_side[v] != -1) link_node(v);
+		dirty = 1;
+	}
+}
+
+// Ordered walk of the largest chain of one colour, starting from its oldest end
+static void extract_side(int side)
+{
+	int best_root = -1;
+
+	for (int i = 0; i < n_nodes; i++)
+	{
+		if (node_side[i] == side && uf_parent[i] == i && (best_root < 0 || uf_size[i] > uf_size[best_root]))
+			best_root = i;
+	}
+
+	staged.n_points[side] = 0;
+	staged.closed[side] = 0;
+	if (best_root < 0) return;
+
+	int start = -1, first_in_chain = -1;
+	for (int i = 0; i < n_nodes && start < 0; i++)
+	{
+		if (node_side[i] != side || uf_find(i) != best_root) continue;
+		if (first_in_chain < 0) first_in_chain = i;
+		if (degree(i) < 2) start = i;
+	}
+
+	// Two ends that met without a new cone to link them: close the lap here
+	if (start >= 0 && uf_size[best_root] >= BOUNDARY_MIN_LOOP)
+	{
+		int other_end = -1;
+		for (int i = n_nodes - 1; i > start && other_end < 0; i--)
+		{
+			if (node_side[i] == side && degree(i) < 2 && uf_find(i) == best_root) other_end = i;
+		}
+		if (other_end >= 0 && hypotf(node_x[start] - node_x[other_end], node_y[start] - node_y[other_end]) < BOUNDARY_LINK_RADIUS
+			&& continues_chain(start, other_end) && continues_chain(other_end, start))
+		{
+			add_link(start, other_end);
+			start = -1;
+		}
+	}
+
+	int prev = -1, current;
+	if (start < 0)
+	{
+		// no ends: closed lap, walk towards the neighbour discovered first
+		staged.closed[side] = 1;
+		start = first_in_chain;
+		int a = node_link[start][0], b = node_link[start][1];
+		staged.points[side][staged.n_points[side]].x = node_x[start];
+		staged.points[side][staged.n_points[side]].y = node_y[start];
+		staged.n_points[side]++;
+		prev = start;
+		current = (a < b) ? a : b;
+	}
+	else
+		current = start;
+
+	while (current != -1 && !(staged.closed[side] && current == start)
+			&& staged.n_points[side] < MAX_BOUNDARY_POINTS)
+	{
+		staged.points[side][staged.n_points[side]].x = node_x[current];
+		staged.points[side][staged.n_points[side]].y = node_y[current];
+		staged.n_points[side]++;
+
+		int next = (node_link[current][0] != prev) ? node_link[current][0] : node_link[current][1];
+		prev = current;
+		current = next;
+	}
+}
+
+void	boundaries_publish()
+{
+	if (!dirty) return;
+	dirty = 0;
+
+	extract_side(BOUNDARY_LEFT);
+	extract_side(BOUNDARY_RIGHT);
+	staged.version = ++n_publications;
+
+	pthread_mutex_lock(&boundaries_mutex);
+		published.version = staged.version;
+		for (int side = 0; side < 2; side++)
+		{
+			published.n_points[side] = staged.n_points[side];
+			published.closed[side] = staged.closed[side];
+			memcpy(published.points[side], staged.points[side], staged.n_points[side] * sizeof(waypoint));
+		}
+	pthread_mutex_unlock(&boundaries_mutex);
+}
+
+void	boundaries_reset()
+{
+	n_nodes = 0;
+	grid_initialized = 0;
+	dirty = 1;			// publishes the empty boundaries
+	boundaries_publish();
+}
+
+int		boundaries_get(track_boundaries *boundaries)
+{
+	pthread_mutex_lock(&boundaries_mutex);
+		if (boundaries->version != published.version)
+		{
+			boundaries->version = published.version;
+			for (int side = 0; side < 2; side++)
+			{
+				boundaries->n_points[side] = published.n_points[side];
+				boundaries->closed[side] = published.closed[side];
+				memcpy(boundaries->points[side], published.points[side], published.n_points[side] * sizeof(waypoint));
+			}
+		}
+	pthread_mutex_unlock(&boundaries_mutex);
+
+	return boundaries->version;
+}
+
+static float point_distance(waypoint a, waypoint b)
+{
+	return hypotf(a.x - b.x, a.y - b.y);
+}
+
+// Pairs every left point with the nearest right point ahead of the previous one
+static int pair_sides(track_boundaries *boundaries, waypoint *centerline, waypoint *left, waypoint *right)
+{
+	waypoint *L = boundaries->points[BOUNDARY_LEFT];
+	waypoint *R = boundaries->points[BOUNDARY_RIGHT];
+	int n_left = boundaries->n_points[BOUNDARY_LEFT];
+	int n_right = boundaries->n_points[BOUNDARY_RIGHT];
+	int right_closed = boundaries->closed[BOUNDARY_RIGHT];
+
+	if (n_left < 2 || n_right < 2) return 0;
+
+	// Right point nearest to the first left point (the only full search)
+	int j = 0;
+	for (int k = 1; k < n_right; k++)
+	{
+		if (point_distance(L[0], R[k]) < point_distance(L[0], R[j])) j = k;
+	}
+
+	// Walk the right boundary in the same direction as the left one
+	int j_from = j, j_to = j + 1;
+	if (j_to == n_right) {
+		if (right_closed) j_to = 0;
+		else { j_from = j - 1; j_to = j; }
+	}
+	float dot = (L[1].x - L[0].x) * (R[j_to].x - R[j_from].x) + (L[1].y - L[0].y) * (R[j_to].y - R[j_from].y);
+	int step = (dot >= 0.0f) ? 1 : -1;
+
+	int n_points = 0;
+
+	for (int i = 0; i < n_left; i++)
+	{
+		// Move forward while one of the next two right points is closer
+		for (int moved = 0; moved < n_right; moved++)
+		{
+			int j1 = j + step, j2 = j + 2 * step;
+			if (right_closed) {
+				j1 = (j1 + n_right) % n_right;
+				j2 = (j2 + 2 * n_right) % n_right;
+			}
+
+			float best = point_distance(L[i], R[j]);
+			if (j1 >= 0 && j1 < n_right && point_distance(L[i], R[j1]) < best) j = j1;
+			else if (j2 >= 0 && j2 < n_right && point_distance(L[i], R[j2]) < best) j = j2;
+			else break;
+		}
+
+		if (point_distance(L[i], R[j]) > BOUNDARY_MAX_WIDTH) continue; // no opposite boundary here
+
+		centerline[n_points].x = 0.5f * (L[i].x + R[j].x);
+		centerline[n_points].y = 0.5f * (L[i].y + R[j].y);
+		left[n_points] = L[i];
+		right[n_points] = R[j];
+		n_points++;
+	}
+
+	return n_points;
+}
+
+int		boundaries_centerline(track_boundaries *boundaries, waypoint *centerline,
+								waypoint *left, waypoint *right, int max_points)
+{
+	// Same graph as the last call: reuse its pairs
+	if (boundaries->paired_version != boundaries->version)
+	{
+		boundaries->n_pairs = pair_sides(boundaries, boundaries->pair_center, boundaries->pair_left, boundaries->pair_right);
+		boundaries->paired_version = boundaries->version;
+	}
+
+	int n_points = (boundaries->n_pairs < max_points) ? boundaries->n_pairs : max_points;
+	memcpy(centerline, boundaries->pair_center, n_points * sizeof(waypoint));
+	if (left != NULL) memcpy(left, boundaries->pair_left, n_points * sizeof(waypoint));
+	if (right != NULL) memcpy(right, boundaries->pair_right, n_points * sizeof(waypoint));
+
+	return n_points;
+}
@@ -7,43 +7,44 @@
 #include "globals.h"
 #include "control.h"
 #include "vehicle.h"
+#include "velocity.h"
+#include "controller.h"
+#include "sim_context.h"
 
-float pedal = 0.0f;         // current speed in m per step
-float steering = 0.0f;      // current steering angle in radians
+float pp_lookahead_min = PP_LOOKAHEAD_MIN;
+float pp_lookahead_gain = PP_LOOKAHEAD_GAIN;
 
-void keyboard_control(float *car_x, float *car_y, int *car_angle)
+void keyboard_control(sim_context *ctx)
 {
-const float     accel_step = 0.01;    // speed increment per key press
+const float     tick = CONTROL_PERIOD_US / 10000.0f;	// the steps below are per 10 ms
+const float     accel_step = 0.01 * tick;    // speed increment per key press
 
-const float     steering_step = 1.5 * deg2rad; // steering increment in radians per key press
+const float     steering_step = 1.5 * deg2rad * tick; // steering increment in radians per key press
 const float     max_steering = 30 * deg2rad;     // maximum steering angle in radians
 
 	// Adjust speed
 	if (key[KEY_UP])
 	{
-		pedal = (pedal + accel_step) > 1.0 ? 1.0 : (pedal + accel_step);
+		ctx->pedal = (ctx->pedal + accel_step) > 1.0 ? 1.0 : (ctx->pedal + accel_step);
 	}
 	if (key[KEY_DOWN])
 	{
-		pedal = (pedal - accel_step) < -1.0 ? -1.0 : (pedal - accel_step);
+		ctx->pedal = (ctx->pedal - accel_step) < -1.0 ? -1.0 : (ctx->pedal - accel_step);
 	}
 
 	// Adjust steering angle
 	if (key[KEY_LEFT])
 	{
-		steering += steering_step;
-		if (steering > max_steering)
-			steering = max_steering;
+		ctx->steering += steering_step;
+		if (ctx->steering > max_steering)
+			ctx->steering = max_steering;
 	}
 	if (key[KEY_RIGHT])
 	{
-		steering -= steering_step;
-		if (steering < -max_steering)
-			steering = -max_steering;
+		ctx->steering -= steering_step;
+		if (ctx->steering < -max_steering)
+			ctx->steering = -max_steering;
 	}
-
-	// Motion model of the vehicle
-	vehicle_model(car_x, car_y, car_angle, pedal, steering);
 }
 
 /* 
@@ -161,135 +162,187 @@ void autonomous_control(float *car_x, float *car_y, int *car_angle, waypoint *tr
 } */
 
 
-// Helper: Normalize an (x,y) vector; returns 0 if vector length is 0.
-static int nomalize(float *x, float *y) {
-    float norm = sqrtf((*x) * (*x) + (*y) * (*y));
-    if (norm < 1e-6f) return 0;
-    *x /= norm;
-    *y /= norm;
-    return 1;
+static float dist2(waypoint p, float x, float y)
+{
+	return (p.x - x) * (p.x - x) + (p.y - y) * (p.y - y);
 }
 
 //---------------------------------------------------------------------
-// Helper: Check if a waypoint is "ahead" of the car. 
-// Here we use the provided idea: compute the angle between the vector from
-// the car to the waypoint and the car's heading. (Assumes car_angle is in degrees.)
-static int is_in_front(float car_angle_deg, float wx, float wy, float cx, float cy) {
-    float dx = wx - cx;
-    float dy = wy - cy;
-    float angle_to_point = (atan2f(dy, dx) / deg2rad);  // convert to degrees
-    // Normalize the angle difference to [-180, 180]
-    float angle_diff = angle_to_point - car_angle_deg;
-    while (angle_diff > 180.0f)  angle_diff -= 360.0f;
-    while (angle_diff < -180.0f) angle_diff += 360.0f;
-    // Consider "ahead" if within +/- 100° (adjust threshold as needed)
-    return (fabs(angle_diff) <= 100.0f);
+// Nearest waypoint to the car. The previous index is kept as a hint and only
+// a small window around it is searched; the full search is needed only when
+// a new path does not contain the previous nearest point any more.
+static int nearest_waypoint(pursuit_state_t *hint, waypoint *path, int n_points, int version, int closed, float car_x, float car_y)
+{
+	if (hint->idx >= 0 && version != hint->version)
+	{
+		// New publication: keep the hint if the path did not move under it
+		if (hint->idx >= n_points ||
+			dist2(path[hint->idx], hint->point.x, hint->point.y) > PP_RELOCALIZE_DISTANCE * PP_RELOCALIZE_DISTANCE)
+			hint->idx = -1;
+	}
+	hint->version = version;
+
+	int best = 0;
+	if (hint->idx < 0)
+	{
+		for (int i = 1; i < n_points; i++)
+		{
+			if (dist2(path[i], car_x, car_y) < dist2(path[best], car_x, car_y)) best = i;
+		}
+	}
+	else
+	{
+		best = hint->idx;
+		for (int k = -PP_SEARCH_BACK; k <= PP_SEARCH_WINDOW; k++)
+		{
+			int i = hint->idx + k;
+			if (closed) i = (i + n_points) % n_points;
+			else if (i < 0 || i >= n_points) continue;
+
+			if (dist2(path[i], car_x, car_y) < dist2(path[best], car_x, car_y)) best = i;
+		}
+	}
+
+	hint->idx = best;
+	hint->point = path[best];
+	return best;
 }
 
 //---------------------------------------------------------------------
-// The new autonomous control routine that uses the centerline logic.
-void autonomous_control(float *car_x, float *car_y, int *car_angle, 
-                                     waypoint *center_waypoints)
+// Point of the path at lookahead distance from the car, walking forward from
+// the nearest waypoint and interpolating inside the segment that crosses the
+// lookahead circle. Returns 0 if the path ends before.
+static int lookahead_point(waypoint *path, int n_points, int closed, int nearest,
+							float car_x, float car_y, float lookahead, waypoint *target)
 {
-	int num_waypoints = 0;
-	while (center_waypoints[num_waypoints].x >= 0.0f) num_waypoints++;
+	float l2 = lookahead * lookahead;
+	int steps = closed ? n_points : n_points - 1 - nearest;
 
-    // Make sure we have at least one waypoint.
-    if (num_waypoints <= 0) {
-        // Fallback: do nothing.
-        vehicle_model(car_x, car_y, car_angle, 0.0f, 0.0f);
-        return;
-    }
-    
-    // 1) Filter the center_waypoints to obtain only the ones "ahead" of the car.
-    // Also, find the one closest to the car (in front).
-    int n_waypoint_index = -1;  // index (in center_waypoints) of the closest ahead point
-    float min_dist = 1e6;
-    int count_ahead = 0;
-    // (Optional: if you need the list of ahead waypoints, you can store them in an array.)
-    waypoint ahead_waypoints[100];
-
-    for (int i = 0; i < num_waypoints; i++) {
-        if (is_in_front((float)*car_angle, center_waypoints[i].x, center_waypoints[i].y, *car_x, *car_y)) {
-            ahead_waypoints[count_ahead++] = center_waypoints[i];
-            float dx = center_waypoints[i].x - *car_x;
-            float dy = center_waypoints[i].y - *car_y;
-            float d = sqrtf(dx * dx + dy * dy);
-            if (d < min_dist) {
-                min_dist = d;
-                n_waypoint_index = i;
-            }
-        }
-    }
+	for (int k = 0; k < steps; k++)
+	{
+		waypoint a = path[(nearest + k) % n_points];
+		waypoint b = path[(nearest + k + 1) % n_points];
+
+		if (dist2(b, car_x, car_y) < l2) continue;
+
+		// |a + t (b - a) - car|^2 = lookahead^2, with a inside the circle (or the first point)
+		float dx = b.x - a.x, dy = b.y - a.y;
+		float fx = a.x - car_x, fy = a.y - car_y;
+		float qa = dx * dx + dy * dy;
+		float qb = 2.0f * (fx * dx + fy * dy);
+		float qc = fx * fx + fy * fy - l2;
+		float disc = qb * qb - 4.0f * qa * qc;
+		float t = (qa > 1e-12f && disc >= 0.0f) ? (-qb + sqrtf(disc)) / (2.0f * qa) : 1.0f;
+		if (t < 0.0f) t = 0.0f;
+		if (t > 1.0f) t = 1.0f;
+
+		target->x = a.x + t * dx;
+		target->y = a.y + t * dy;
+		return 1;
+	}
 
-    // If no ahead waypoints are found, then use a fallback (e.g., go straight)
-    if (count_ahead == 0 || n_waypoint_index < 0) {
-        vehicle_model(car_x, car_y, car_angle, 0.0f, 0.0f);
-        return;
-    }
+	if (closed || n_points == 0) return 0;
+	*target = path[n_points - 1]; // end of an open path: aim at its last point
+	return 1;
+}
+
+//---------------------------------------------------------------------
+// Pure pursuit on the last published trajectory.
+void autonomous_control(sim_context *ctx, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path)
+{
+	waypoint *trajectory = path->points;
+	int n_points = path->n_points;
+
+	if (n_points < 2) {
+		ctx->pursuit.idx = -1;
+		ctx->pedal = 0.0f;
+		ctx->steering = 0.0f;
+		return;
+	}
+
+	int closed = dist2(trajectory[0], trajectory[n_points-1].x, trajectory[n_points-1].y) < PP_CLOSED_DISTANCE * PP_CLOSED_DISTANCE;
+
+	// 1) Nearest waypoint (hinted) and lookahead point
+	int nearest = nearest_waypoint(&ctx->pursuit, trajectory, n_points, path->version, closed, *car_x, *car_y);
+
+	float speed = vehicle_speed(ctx);
+	float lookahead = pp_lookahead_min + pp_lookahead_gain * speed;
+	waypoint target;
+
+	// Heading unit vector (y axis pointing down)
+	float car_angle_rad = vehicle_yaw(ctx, *car_angle);
+	float dir_x = cosf(car_angle_rad);
+	float dir_y = -sinf(car_angle_rad);
+
+	float dx = 0.0f, dy = 0.0f;
+	if (lookahead_point(trajectory, n_points, closed, nearest, *car_x, *car_y, lookahead, &target))
+	{
+		dx = target.x - *car_x;
+		dy = target.y - *car_y;
+	}
+
+	// 2) No target ahead of the car: brake
+	if (dx * dir_x + dy * dir_y <= 0.0f) {
+		ctx->pedal = -1.0f;
+		ctx->steering = 0.0f;
+		return;
+	}
+
+	// 3) Pure pursuit curvature k = 2 y / d^2, y being the lateral (left) offset of the target
+	float lateral = dx * dir_y - dy * dir_x;
+	float curvature = 2.0f * lateral / (dx * dx + dy * dy);
+	float delta = atanf(VEHICLE_WHEELBASE * curvature);
+
+	if (delta > VEHICLE_MAX_STEERING) delta = VEHICLE_MAX_STEERING;
+	if (delta < -VEHICLE_MAX_STEERING) delta = -VEHICLE_MAX_STEERING;
+
+	// 4) Pedal from the speed profile interpolated at the projection of the car on the
+	// segment after the nearest point: a positive pedal maps to pedal * VEHICLE_MAX_SPEED,
+	// a negative one brakes (removing the excess in one step)
+	int next = closed ? (nearest + 1) % n_points : (nearest + 1 < n_points ? nearest + 1 : nearest);
+	float sx = trajectory[next].x - trajectory[nearest].x, sy = trajectory[next].y - trajectory[nearest].y;
+	float len2 = sx * sx + sy * sy;
+	float t = (len2 > 1e-12f) ? ((*car_x - trajectory[nearest].x) * sx + (*car_y - trajectory[nearest].y) * sy) / len2 : 0.0f;
+	t = fminf(fmaxf(t, 0.0f), 1.0f);
+
+	float target_speed = (1.0f - t) * path->speed[nearest] + t * path->speed[next];
+	if (target_speed >= speed)
+		ctx->pedal = target_speed / VEHICLE_MAX_SPEED;
+	else
+		ctx->pedal = fmaxf(-1.0f, (target_speed - speed) / (speed * VEHICLE_DT * VEHICLE_MAX_BRAKING / VEHICLE_MASS));
+	ctx->steering = delta;
 
-    // 2) Determine the desired (reference) trajectory vector.
-    float ref_vec_x = 0.0f, ref_vec_y = 0.0f;
-
-    if ((count_ahead > 2) && (n_waypoint_index > 0) && (n_waypoint_index + 1 < num_waypoints)) {
-        // Case A: We have at least 3 points (previous, current, next).
-        // Use the points [n_waypoint_index-1, n_waypoint_index, n_waypoint_index+1].
-        // One simple way is to define the desired direction as the vector from the previous
-        // waypoint to the next one (i.e. “smoothing” the trajectory).
-        waypoint prev = center_waypoints[n_waypoint_index - 1];
-        waypoint next = center_waypoints[n_waypoint_index + 1];
-        ref_vec_x = next.x - prev.x;
-        ref_vec_y = next.y - prev.y;
-    }
-    else {
-        if (num_waypoints > 2) {
-            // Case B: If there is only one or two ahead points, use the last two waypoints of the full centerline.
-            waypoint last_wp = center_waypoints[num_waypoints - 1];
-            waypoint second_last = center_waypoints[num_waypoints - 2];
-            // Here we add the vector from the car to the last waypoint with the segment between the last two points.
-            ref_vec_x = (last_wp.x - *car_x) + (last_wp.x - second_last.x);
-            ref_vec_y = (last_wp.y - *car_y) + (last_wp.y - second_last.y);
-        }
-        else {
-            // Case C: Only one waypoint is available.
-            waypoint last_wp = center_waypoints[num_waypoints - 1];
-            ref_vec_x = last_wp.x - *car_x;
-            ref_vec_y = last_wp.y - *car_y;
-        }
-    }
-    
-    // Normalize the reference trajectory vector.
-    if (!nomalize(&ref_vec_x, &ref_vec_y)) {
-        // If normalization fails, set a default forward direction.
-        ref_vec_x = 1.0f;
-        ref_vec_y = 0.0f;
-    }
-    
-    // 3) Compute the car’s current heading unit vector.
-    // Here, car_angle is in degrees so we convert it to radians.
-    float car_angle_rad = (*car_angle) * deg2rad;
-    float dir_x = cosf(car_angle_rad);
-    float dir_y = sinf(car_angle_rad);
-    
-    // 4) Compute the cross product between the reference vector and the current direction.
-    // In 2D the cross product (scalar) is: ref_x*dir_y - ref_y*dir_x.
-    float cross = ref_vec_x * dir_y - ref_vec_y * dir_x;
-    
-    // Since both vectors are unit length, sin(theta) = cross. Compute the angle difference.
-    float delta = asinf(cross);  // desired steering correction (in radians)
-    
-    // (Optional: If you have a PID controller, you can process delta here.)
-    // delta = pid_compute(desired, delta);
-
-    
-    // 6) (Optional) Choose a pedal value – here we use a constant.
-    float pedal = 0.1f;   // adjust as needed
-    
 #ifdef DEBUG
-    printf("Car pos=(%.2f, %.2f), car_angle=%d\n", *car_x, *car_y, *car_angle);
-    printf("Ref vector: (%.2f, %.2f), Delta=%.2f rad\n", ref_vec_x, ref_vec_y, delta);
+	printf("Car pos=(%.2f, %.2f), car_angle=%d\n", *car_x, *car_y, *car_angle);
+	printf("Nearest=%d, target=(%.2f, %.2f), Delta=%.2f rad\n", nearest, target.x, target.y, delta);
 #endif
+}
 
-    // 7) Finally, update the vehicle’s model with the computed control signals.
-    vehicle_model(car_x, car_y, car_angle, pedal, delta);
+//---------------------------------------------------------------------
+// Controller plug-ins (see controller.h)
+static void keyboard_step(sim_context *ctx, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path)
+{
+	(void)car_x; (void)car_y; (void)car_angle; (void)path;	// driven by the keys
+	keyboard_control(ctx);
+}
+
+static void pursuit_reset(sim_context *ctx)
+{
+	ctx->pursuit.idx = -1;
 }
+
+const controller_t keyboard_controller = {
+	.name = "keyboard",
+	.budget_us = KEYBOARD_BUDGET_US,
+	.init = NULL,
+	.step = keyboard_step,
+	.reset = NULL,
+};
+
+const controller_t pursuit_controller = {
+	.name = "pursuit",
+	.budget_us = PP_BUDGET_US,
+	.init = NULL,
+	.step = autonomous_control,
+	.reset = pursuit_reset,
+};
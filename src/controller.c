@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "globals.h"
+#include "controller.h"
+#include "sim_context.h"
+#include "vehicle.h"
+#include "trace.h"
+
+// ---------------- Registry ----------------
+static const controller_t *controllers[] = {
+	&keyboard_controller,
+	&pursuit_controller,
+	&mpc_controller,
+};
+#define N_CONTROLLERS	((int)(sizeof(controllers) / sizeof(controllers[0])))
+
+static controller_stats_t	stats[N_CONTROLLERS];
+
+static int	manual_idx = 0;		// keyboard
+static int	active_idx = -1;	// autonomous controller selected at startup
+
+
+static long thread_cpu_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return t.tv_sec * 1000000L + t.tv_nsec / 1000;
+}
+
+int		controller_select(const char *name)
+{
+	for (int i = 0; i < N_CONTROLLERS; i++)
+		trace_add_label(i, controllers[i]->name);
+
+	for (int i = 0; i < N_CONTROLLERS; i++)
+	{
+		if (strcmp(controllers[i]->name, name) != 0) continue;
+
+		active_idx = i;
+		if (controllers[i]->init != NULL) controllers[i]->init();
+		return 1;
+	}
+	return 0;
+}
+
+void	controller_list(FILE *out)
+{
+	for (int i = 0; i < N_CONTROLLERS; i++)
+		fprintf(out, "  %-10s budget %ld us\n", controllers[i]->name, controllers[i]->budget_us);
+}
+
+void	controller_step(sim_context *ctx, int autonomous, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path)
+{
+	int idx = (autonomous && active_idx >= 0) ? active_idx : manual_idx;
+	const controller_t *controller = controllers[idx];
+
+	// Handover: the incoming controller must not reuse stale state
+	if (idx != ctx->controller_idx)
+	{
+		if (controller->reset != NULL) controller->reset(ctx);
+		ctx->controller_idx = idx;
+	}
+
+	// The control law only: the plant is not part of the budget
+	long start = thread_cpu_us();
+	controller->step(ctx, car_x, car_y, car_angle, path);
+	long cpu = thread_cpu_us() - start;
+
+	vehicle_model(ctx, car_x, car_y, car_angle, ctx->pedal, ctx->steering);
+
+	stats[idx].steps++;
+	stats[idx].cpu_sum_us += cpu;
+	if (cpu > stats[idx].cpu_max_us) stats[idx].cpu_max_us = cpu;
+
+	// No printf from the 1 kHz loop: a trace record, and the total in controller_print_stats()
+	if (cpu > controller->budget_us)
+	{
+		stats[idx].overruns++;
+		trace_overrun(idx, cpu, controller->budget_us);
+	}
+}
+
+void	controller_warmup(sim_context *ctx, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path)
+{
+	const controller_t *controller = controllers[(active_idx >= 0) ? active_idx : manual_idx];
+
+	if (controller->reset != NULL) controller->reset(ctx);
+	controller->step(ctx, car_x, car_y, car_angle, path);
+	vehicle_model(ctx, car_x, car_y, car_angle, ctx->pedal, ctx->steering);
+	ctx->controller_idx = -1;
+}
+
+void	controller_get_stats(const controller_t *controller, controller_stats_t *out)
+{
+	for (int i = 0; i < N_CONTROLLERS; i++)
+	{
+		if (controllers[i] == controller) {
+			*out = stats[i];
+			return;
+		}
+	}
+	memset(out, 0, sizeof(*out));
+}
+
+void	controller_print_stats()
+{
+	printf("Controllers (CPU time per step):\n");
+	for (int i = 0; i < N_CONTROLLERS; i++)
+	{
+		if (stats[i].steps == 0) continue;
+
+		printf("  %-10s %ld steps, mean %.1f us, max %ld us, %ld over the %ld us budget\n",
+			controllers[i]->name, stats[i].steps, (double)stats[i].cpu_sum_us / stats[i].steps,
+			stats[i].cpu_max_us, stats[i].overruns, controllers[i]->budget_us);
+	}
+}
@@ -8,6 +8,10 @@
 #include "trajectory.h"
 #include "utilities.h"
 #include "control.h"
+#include "raceline.h"
+#include "sim_context.h"
+#include "tasks.h"
+#include "ptask.h"
 
 
 void draw_dir_arrow()
@@ -204,7 +208,7 @@ void draw_perception()
 
 	draw_detected_cones(detected_cones);
 
-	draw_cone_map(track_map, track_map_idx);
+	draw_cone_map(track_map, default_context.track_map_idx);
 
 	draw_sprite(
 			display_buffer, 
@@ -218,7 +222,7 @@ void draw_trajectory(waypoint *trajectory)
 {
 	clear_bitmap(trajectory_bmp);
 	clear_to_color(trajectory_bmp, pink);
-	for (int traj_point_idx = 0; traj_point_idx < trajectory_idx; traj_point_idx++)
+	for (int traj_point_idx = 0; traj_point_idx < default_context.trajectory_idx; traj_point_idx++)
 	{
 		// printf("Trajectory point %d: (%f, %f)\n", traj_point_idx, trajectory[traj_point_idx].x, trajectory[traj_point_idx].y);
 		circlefill(
@@ -259,13 +263,34 @@ void draw_trajectory(waypoint *trajectory)
 	draw_sprite(display_buffer, trajectory_bmp, 0, 0);
 }
 
+void draw_raceline()
+{
+	static waypoint raceline[MAX_RACELINE_POINTS];
+	static int raceline_n = 0;
+
+	// keep the last copy if the optimizer is publishing right now
+	int n = raceline_get(raceline, MAX_RACELINE_POINTS);
+	if (n >= 0) raceline_n = n;
+
+	for (int i = 0; i < raceline_n; i++)
+	{
+		circlefill(
+			display_buffer,
+			(int)(raceline[i].x * px_per_meter),
+			(int)(raceline[i].y * px_per_meter),
+			2,
+			makecol(255, 0, 0)
+		);
+	}
+}
+
 void draw_controls(){
 	rotate_scaled_sprite(
 		display_buffer, 
 		steering_wheel, 
 		100, 
 		100, 
-		ftofix(angle_rotation_sprite(( ( (int)(steering/deg2rad) + 90 ) %360 ))) ,  // deg to fixed point
+		ftofix(angle_rotation_sprite(( ( (int)(default_context.steering/deg2rad) + 90 ) %360 ))) ,  // deg to fixed point
 		ftofix(1)
 	);
 
@@ -274,7 +299,7 @@ void draw_controls(){
 	int gauge_y = 200;
 	int gauge_width = 30;
 	int gauge_height = 100;
-	int fill_height = (int)(pedal * gauge_height);
+	int fill_height = (int)(default_context.pedal * gauge_height);
 
 	// Draw gauge outline
 	rect(
@@ -287,7 +312,7 @@ void draw_controls(){
 	);
 
 	// Fill gauge based on pedal level
-	if (pedal > 0.0)
+	if (default_context.pedal > 0.0)
 	{
 		rectfill(
 			display_buffer, 
@@ -311,6 +336,27 @@ void draw_controls(){
 	}
 }
 
+// Live job statistics of the tasks (ptask), bottom left: p99 response, WCET, deadline misses
+void draw_task_stats()
+{
+	char		row[80];
+	task_stats	stats;
+	int			y = Y_MAX - 10 * N_SIM_TASKS;
+
+	for (int task = PERCEPTION_TASK; task < N_SIM_TASKS; task++, y += 10)
+	{
+		task_get_stats(task, &stats);
+		if (stats.jobs == 0) continue;
+
+		snprintf(row, sizeof(row), "%-13s R99 %6.1f ms  C %6.1f ms  miss %lu  over %lu",
+			task_names[task],
+			ptask_metric_percentile(&stats.metric[PTASK_RESPONSE], 99.0) * 1e-6,
+			stats.metric[PTASK_EXEC].max * 1e-6,
+			stats.dmiss, stats.overruns);
+		textout_ex(display_buffer, font, row, 10, y, makecol(255, 255, 255), -1);
+	}
+}
+
 void update_display()
 {
 	pthread_mutex_lock(&draw_mutex);
@@ -323,6 +369,7 @@ void update_display()
 
 		draw_perception();
 		draw_trajectory(trajectory);
+		draw_raceline();
 
 		int text_width = text_length(font, title);
 		textout_ex(
@@ -336,6 +383,7 @@ void update_display()
 		);
 
 		draw_controls();
+		draw_task_stats();
 
 		// Draw final buffer to screen
 		blit(display_buffer, screen, 0, 0, 0, 0, X_MAX, Y_MAX);
@@ -28,8 +28,4 @@ BITMAP *display_buffer  = NULL;
 int grass_green, asphalt_gray, white, pink;
 int yellow, blue;
 
-/* LiDAR */
-pointcloud_t measures[360];
-
-sem_t lidar_sem;
 pthread_mutex_t draw_mutex = PTHREAD_MUTEX_INITIALIZER;
\ No newline at end of file
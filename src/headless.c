@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "globals.h"
+#include "headless.h"
+#include "tasks.h"
+#include "ptask.h"
+
+// Released every period (trajectory: after each perception) / CONTROL_PERIOD_US control jobs, in this order at the same instant
+enum { STAGE_PERCEPTION, STAGE_TRAJECTORY, STAGE_CONTROL, STAGE_RACELINE, N_STAGES };
+
+typedef struct {
+	const char	*name;
+	long		period_us;			// relative deadline too
+	long		jobs;
+	long		sum_ns, max_ns;		// CPU time per job
+	long		misses;				// jobs using more CPU time than the deadline
+} stage_t;
+
+int		headless_perception_period = PERCEPTION_PERIOD;
+int		headless_trajectory_deadline = TRAJECTORY_DEADLINE;
+int		headless_raceline_period = RACELINE_PERIOD;
+
+static stage_t stages[N_STAGES] = {
+	[STAGE_PERCEPTION]	= { .name = "PERCEPTION" },
+	[STAGE_TRAJECTORY]	= { .name = "TRAJ_PLANNING" },
+	[STAGE_CONTROL]		= { .name = "CONTROL" },
+	[STAGE_RACELINE]	= { .name = "RACELINE" },
+};
+
+#define MAX_LAPS	1000
+static float	lap_end_s[MAX_LAPS];
+
+
+static long now_ns(clockid_t clock)
+{
+	struct timespec t;
+	clock_gettime(clock, &t);
+	return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+static void run_stage(int s)
+{
+	// Process CPU time: includes the lattice workers
+	long start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+	switch (s)
+	{
+		case STAGE_PERCEPTION:
+			perception_job();
+			break;
+
+		case STAGE_TRAJECTORY: {
+			// Relative deadline of the stage, on the virtual clock:
+			// the planner is never cut, whatever the speed of the machine
+			timespec_custom deadline;
+			ptask_gettime(&deadline);
+			time_add_us(&deadline, stages[STAGE_TRAJECTORY].period_us);
+			trajectory_job(&deadline);
+			break;
+		}
+
+		case STAGE_CONTROL:
+			control_job(1);
+			break;
+
+		case STAGE_RACELINE:
+			raceline_job();
+			break;
+	}
+
+	long elapsed = now_ns(CLOCK_PROCESS_CPUTIME_ID) - start;
+	stages[s].jobs++;
+	stages[s].sum_ns += elapsed;
+	if (elapsed > stages[s].max_ns) stages[s].max_ns = elapsed;
+	if (elapsed > stages[s].period_us * 1000L) stages[s].misses++;
+}
+
+int		headless_run(int laps, float seconds, float start_x, float start_y, int start_angle, const char *output)
+{
+	FILE *out = fopen(output, "w");
+	if (out == NULL) {
+		perror(output);
+		return -1;
+	}
+	if (laps > MAX_LAPS) laps = MAX_LAPS;
+	if (seconds <= 0.0f) seconds = HEADLESS_MAX_SECONDS;
+
+	long end_us = (long)(seconds * 1e6f);
+
+	stages[STAGE_PERCEPTION].period_us = headless_perception_period * 1000L;
+	stages[STAGE_TRAJECTORY].period_us = headless_trajectory_deadline * 1000L;
+	stages[STAGE_CONTROL].period_us = CONTROL_PERIOD_US;
+	stages[STAGE_RACELINE].period_us = headless_raceline_period * 1000L;
+
+	// Jobs are released here, the virtual clock only follows t_us
+	ptask_set_clock(PTASK_CLOCK_VIRTUAL);
+	ptask_init(SCHED_OTHER);
+
+	car_x = start_x;
+	car_y = start_y;
+	car_angle = start_angle;
+
+	// Lap gate at the start pose (y axis pointing down)
+	float gate_x = car_x, gate_y = car_y;
+	float dir_x = cosf(car_angle * deg2rad), dir_y = -sinf(car_angle * deg2rad);
+	float prev_along = 0.0f, driven = 0.0f;
+	int completed = 0;
+
+	long start_ns = now_ns(CLOCK_MONOTONIC);
+	long t_us;
+
+	for (t_us = 0; t_us < end_us && (laps == 0 || completed < laps); t_us += CONTROL_PERIOD_US)
+	{
+		float prev_x = car_x, prev_y = car_y;
+
+		// One plan per scan, right after it, as activated by connect_tasks() in the real-time mode
+		if (t_us % stages[STAGE_PERCEPTION].period_us == 0) {
+			run_stage(STAGE_PERCEPTION);
+			run_stage(STAGE_TRAJECTORY);
+		}
+		run_stage(STAGE_CONTROL);
+		if (t_us % stages[STAGE_RACELINE].period_us == 0)
+			run_stage(STAGE_RACELINE);
+		ptask_clock_advance_us(CONTROL_PERIOD_US);
+
+		// Lap: forward crossing of the gate after LAP_MIN_DISTANCE
+		driven += hypotf(car_x - prev_x, car_y - prev_y);
+		float along = (car_x - gate_x) * dir_x + (car_y - gate_y) * dir_y;
+		float across = (car_x - gate_x) * dir_y - (car_y - gate_y) * dir_x;
+
+		if (prev_along < 0.0f && along >= 0.0f && fabsf(across) < LAP_GATE_HALF_WIDTH && driven >= LAP_MIN_DISTANCE)
+		{
+			if (completed < MAX_LAPS) lap_end_s[completed] = (t_us + CONTROL_PERIOD_US) * 1e-6f;
+			completed++;
+			driven = 0.0f;
+		}
+		prev_along = along;
+	}
+
+	double wall_s = (now_ns(CLOCK_MONOTONIC) - start_ns) * 1e-9;
+	double sim_s = t_us * 1e-6;
+
+	// Profiler row format, as runtime() and the stats counters
+	for (int i = 0; i < completed && i < MAX_LAPS; i++)
+		fprintf(out, "[LAP],%d,%.3f\n", i + 1, lap_end_s[i] - (i > 0 ? lap_end_s[i-1] : 0.0f));
+
+	for (int s = 0; s < N_STAGES; s++)
+	{
+		if (stages[s].jobs == 0) continue;
+		fprintf(out, "[%s],JOBS,%ld\n", stages[s].name, stages[s].jobs);
+		fprintf(out, "[%s],CPU_MEAN_US,%.1f\n", stages[s].name, stages[s].sum_ns * 1e-3 / stages[s].jobs);
+		fprintf(out, "[%s],CPU_MAX_US,%.1f\n", stages[s].name, stages[s].max_ns * 1e-3);
+		fprintf(out, "[%s],MISSES,%ld\n", stages[s].name, stages[s].misses);
+	}
+	fprintf(out, "[RUN],SIM_S,%.3f\n", sim_s);
+	fprintf(out, "[RUN],WALL_S,%.3f\n", wall_s);
+	fclose(out);
+
+	printf("Headless: %d laps in %.1f s simulated, %.2f s wall (%.0fx real time), written to %s\n",
+		completed, sim_s, wall_s, wall_s > 0.0 ? sim_s / wall_s : 0.0, output);
+
+	return completed;
+}
@@ -0,0 +1,293 @@
+#include <math.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "globals.h"
+#include "perception.h"
+#include "trajectory.h"
+#include "lattice.h"
+#include "sim_context.h"
+
+/*
+	Lattice local planner.
+
+	From the current pose, LATTICE_N_CANDIDATES clothoids are sampled: the curvature
+	ramps linearly from the curvature of the last chosen path to one of
+	LATTICE_N_CURVATURES end values, over one of LATTICE_N_LENGTHS lengths.
+	Each candidate is scored against the mapped cones (clearance, curvature,
+	distance from the middle of the track, progress); the scoring is split
+	across a pool of worker threads.
+*/
+
+// ---------------- Run data (read-only for the workers during a run) ----------------
+static float	pose_x, pose_y, pose_heading;	// heading in radians, y axis pointing down
+static float	start_curvature = 0.0f;
+static cone		local_cones[MAX_CONES_MAP];
+static int		n_local_cones;
+
+static float	cost[LATTICE_N_CANDIDATES];
+static waypoint	samples[LATTICE_N_CANDIDATES][LATTICE_POINTS];
+
+// ---------------- Worker pool ----------------
+static pthread_t		workers[LATTICE_MAX_WORKERS];
+static int				n_workers = 0;
+static pthread_mutex_t	pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	pool_done = PTHREAD_COND_INITIALIZER;
+static int				pool_generation = 0;
+static int				start_generation = 0;	// pool_generation when the workers were created
+static int				pool_pending = 0;
+static int				pool_quit = 0;
+
+static lattice_stats_t	lattice_stats;
+
+
+static float candidate_end_curvature(int candidate)
+{
+	int k = candidate % LATTICE_N_CURVATURES;
+	return -LATTICE_MAX_CURVATURE + 2.0f * LATTICE_MAX_CURVATURE * k / (LATTICE_N_CURVATURES - 1);
+}
+
+static float candidate_length(int candidate)
+{
+	return LATTICE_LENGTH_STEP * (1 + candidate / LATTICE_N_CURVATURES);
+}
+
+// Generates and scores one candidate (INFINITY if infeasible)
+static void score_candidate(int candidate)
+{
+	float length = candidate_length(candidate);
+	float end_curvature = candidate_end_curvature(candidate);
+	float ds = length / LATTICE_POINTS;
+
+	float x = pose_x, y = pose_y, heading = pose_heading;
+	float clearance_cost = 0.0f, curvature_cost = 0.0f;
+	float dist_blue = INFINITY, dist_yellow = INFINITY;
+	float center_error = 0.0f;
+
+	for (int p = 0; p < LATTICE_POINTS; p++)
+	{
+		// Clothoid: curvature linear in the arc length (midpoint integration)
+		float s_mid = (p + 0.5f) * ds;
+		float k = start_curvature + (end_curvature - start_curvature) * s_mid / length;
+		float mid_heading = heading + 0.5f * k * ds;
+
+		x += ds * cosf(mid_heading);
+		y -= ds * sinf(mid_heading);
+		heading += k * ds;
+
+		samples[candidate][p].x = x;
+		samples[candidate][p].y = y;
+
+		dist_blue = INFINITY;
+		dist_yellow = INFINITY;
+		float clearance = INFINITY;	// any cone, also of another colour
+
+		for (int j = 0; j < n_local_cones; j++)
+		{
+			float dist = hypotf(local_cones[j].x - x, local_cones[j].y - y);
+			if (local_cones[j].color == blue) dist_blue = fminf(dist_blue, dist);
+			else if (local_cones[j].color == yellow) dist_yellow = fminf(dist_yellow, dist);
+			clearance = fminf(clearance, dist);
+		}
+
+		// The width is only known with both boundaries in range
+		int both = (dist_blue < INFINITY && dist_yellow < INFINITY);
+
+		if (clearance < LATTICE_MIN_CLEARANCE || (both && dist_blue + dist_yellow > LATTICE_MAX_TRACK_WIDTH))
+		{
+			cost[candidate] = INFINITY; // hits a cone or leaves the track
+			return;
+		}
+
+		clearance_cost += ds / clearance;
+		curvature_cost += k * k * ds;
+	}
+
+	// Offset from the middle at the end of the candidate (twice the offset, as |blue - yellow|),
+	// from the visible side alone if the other one is out of range
+	if (dist_blue < INFINITY && dist_yellow < INFINITY)
+		center_error = fabsf(dist_blue - dist_yellow);
+	else if (dist_blue < INFINITY)
+		center_error = 2.0f * fabsf(dist_blue - LATTICE_SIDE_DISTANCE);
+	else if (dist_yellow < INFINITY)
+		center_error = 2.0f * fabsf(dist_yellow - LATTICE_SIDE_DISTANCE);
+
+	cost[candidate] = LATTICE_W_CLEARANCE * clearance_cost
+					+ LATTICE_W_CURVATURE * curvature_cost
+					+ LATTICE_W_CENTER * center_error
+					- LATTICE_W_PROGRESS * length;
+}
+
+static void score_slice(int worker, int workers_count)
+{
+	int first = worker * LATTICE_N_CANDIDATES / workers_count;
+	int last = (worker + 1) * LATTICE_N_CANDIDATES / workers_count;
+
+	for (int candidate = first; candidate < last; candidate++)
+		score_candidate(candidate);
+}
+
+static void *lattice_worker(void *arg)
+{
+	int worker = (int)(long)arg;
+
+	// After a restart pool_generation is not 0: wait for the next run, not for a past one
+	pthread_mutex_lock(&pool_mutex);
+		int seen_generation = start_generation;
+	pthread_mutex_unlock(&pool_mutex);
+
+	while (1)
+	{
+		pthread_mutex_lock(&pool_mutex);
+			while (pool_generation == seen_generation && !pool_quit)
+				pthread_cond_wait(&pool_start, &pool_mutex);
+			seen_generation = pool_generation;
+			int quit = pool_quit;
+		pthread_mutex_unlock(&pool_mutex);
+
+		if (quit) break;
+
+		score_slice(worker, n_workers);
+
+		pthread_mutex_lock(&pool_mutex);
+			if (--pool_pending == 0)
+				pthread_cond_signal(&pool_done);
+		pthread_mutex_unlock(&pool_mutex);
+	}
+	return NULL;
+}
+
+int		lattice_init(int workers_count)
+{
+	if (workers_count > LATTICE_MAX_WORKERS) workers_count = LATTICE_MAX_WORKERS;
+	if (workers_count < 0) workers_count = 0;
+
+	pthread_mutex_lock(&pool_mutex);
+		pool_quit = 0;
+		start_generation = pool_generation;
+	pthread_mutex_unlock(&pool_mutex);
+
+	// The workers slice the candidates by n_workers: set it before any of them runs
+	n_workers = workers_count;
+	for (int i = 0; i < workers_count; i++)
+	{
+		if (pthread_create(&workers[i], NULL, lattice_worker, (void *)(long)i) != 0)
+		{
+			fprintf(stderr, "Lattice: failed to create worker %d, scoring without the pool\n", i);
+			n_workers = i;	// the workers to join
+			lattice_shutdown();
+			break;
+		}
+	}
+	lattice_stats.n_workers = n_workers;
+	return n_workers;
+}
+
+void	lattice_shutdown()
+{
+	pthread_mutex_lock(&pool_mutex);
+		pool_quit = 1;
+		pthread_cond_broadcast(&pool_start);
+	pthread_mutex_unlock(&pool_mutex);
+
+	for (int i = 0; i < n_workers; i++)
+		pthread_join(workers[i], NULL);
+	n_workers = 0;
+}
+
+void	lattice_planning(sim_context *ctx, float car_x, float car_y, float car_angle)
+{
+	struct timespec t0, t1;
+
+	// Only the cones that a candidate can reach are scored
+	float reach = LATTICE_LENGTH_STEP * LATTICE_N_LENGTHS + LATTICE_MAX_TRACK_WIDTH;
+
+	n_local_cones = 0;
+	for (int i = 0; i < ctx->track_map_idx; i++)
+	{
+		if (hypotf(ctx->track_map[i].x - car_x, ctx->track_map[i].y - car_y) < reach)
+			local_cones[n_local_cones++] = ctx->track_map[i];
+	}
+
+	pose_x = car_x;
+	pose_y = car_y;
+	pose_heading = car_angle * deg2rad;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	if (n_workers == 0)
+	{
+		score_slice(0, 1); // no pool: score inline
+	}
+	else
+	{
+		pthread_mutex_lock(&pool_mutex);
+			pool_pending = n_workers;
+			pool_generation++;
+			pthread_cond_broadcast(&pool_start);
+
+			while (pool_pending > 0)
+				pthread_cond_wait(&pool_done, &pool_mutex);
+		pthread_mutex_unlock(&pool_mutex);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (!ctx->warmup)
+	{
+		lattice_stats.runs++;
+		lattice_stats.candidates += LATTICE_N_CANDIDATES;
+		lattice_stats.scoring_us += (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000;
+	}
+
+	// Select the best feasible candidate
+	int best = -1;
+	for (int candidate = 0; candidate < LATTICE_N_CANDIDATES; candidate++)
+	{
+		if (cost[candidate] < INFINITY && (best < 0 || cost[candidate] < cost[best]))
+			best = candidate;
+	}
+
+	int n_points = 0;
+
+	if (best < 0)
+	{
+		if (!ctx->warmup) {
+			lattice_stats.infeasible_runs++;
+			start_curvature = 0.0f;
+		}
+	}
+	else
+	{
+		for (n_points = 0; n_points < LATTICE_POINTS; n_points++)
+			ctx->trajectory[n_points] = samples[best][n_points];
+
+		// next lattice starts from the curvature of the chosen path after one sample
+		if (!ctx->warmup)
+			start_curvature += (candidate_end_curvature(best) - start_curvature) / LATTICE_POINTS;
+	}
+
+	for (int i = n_points; (i == n_points || i < ctx->trajectory_idx) && i < 2*MAX_DETECTED_CONES; i++)
+	{
+		ctx->trajectory[i].x = -1;
+		ctx->trajectory[i].y = -1;
+	}
+	ctx->trajectory_idx = n_points;
+}
+
+void	lattice_get_stats(lattice_stats_t *stats)
+{
+	*stats = lattice_stats;
+}
+
+void	lattice_print_stats()
+{
+	double seconds = lattice_stats.scoring_us / 1e6;
+
+	printf("Lattice planner: %ld runs, %ld candidates, %ld runs without a feasible candidate\n",
+		lattice_stats.runs, lattice_stats.candidates, lattice_stats.infeasible_runs);
+	printf("  %d workers, %.0f candidates/s\n",
+		lattice_stats.n_workers, seconds > 0.0 ? lattice_stats.candidates / seconds : 0.0);
+}
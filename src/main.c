@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <allegro.h>
 
 #include "control.h"
@@ -10,12 +13,20 @@
 #include "utilities.h"
 #include "vehicle.h"
 #include "ptask.h"
-
-const char	filename[100] = "track/cones.yaml";
+#include "lattice.h"
+#include "mpc.h"
+#include "controller.h"
+#include "headless.h"
+#include "params.h"
+#include "sim_context.h"
+#include "trace.h"
+
+const char	*filename = "track/cones.yaml";
 int car_x_px, car_y_px;
 int car_bitmap_x, car_bitmap_y;
 
 void init_allegro();
+void init_colors();
 
 void init_track();
 void init_car();
@@ -25,43 +36,192 @@ void init_visual_controls();
 void init_bitmaps();
 void update_screen();
 
-int main(void)
+void print_stats();
+void print_task_stats(int cyclic);
+int  run_headless(int laps, float seconds, float start_x, float start_y, int start_angle, const char *output);
+void usage(const char *program);
+
+int main(int argc, char **argv)
 {
+	// ./2D_sim [controller] [options], see usage()
+	const char *controller_name = CONTROLLER_DEFAULT;
+	const char *output = "headless.csv";
+	const char *trace_file = TRACE_FILE;
+	int headless = 0, laps = 0, virtual_clock = 0;
+	int policy = SCHED_OTHER, pin = 0, rt_start = 0, cyclic = 0;
+	float seconds = 0.0f;
+	float start_x = HEADLESS_START_X, start_y = HEADLESS_START_Y;
+	int start_angle = HEADLESS_START_ANGLE;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0) headless = 1;
+		else if (strcmp(argv[i], "--virtual-clock") == 0) virtual_clock = 1;
+		else if (strcmp(argv[i], "--pin") == 0) pin = 1;
+		else if (strcmp(argv[i], "--rt-start") == 0) rt_start = 1;
+		else if (strcmp(argv[i], "--cyclic") == 0) cyclic = 1;
+		else if (strcmp(argv[i], "--sched") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "other") == 0) policy = SCHED_OTHER;
+			else if (strcmp(argv[i], "rm") == 0) policy = PTASK_SCHED_RM;
+			else if (strcmp(argv[i], "edf") == 0) policy = SCHED_DEADLINE;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--laps") == 0 && i + 1 < argc) laps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) output = argv[++i];
+		else if (strcmp(argv[i], "--track") == 0 && i + 1 < argc) filename = argv[++i];
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) trace_file = argv[++i];
+		else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%f,%f,%d", &start_x, &start_y, &start_angle) != 3) {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--set") == 0 && i + 1 < argc) {
+			if (!param_set(argv[++i])) {
+				fprintf(stderr, "Invalid parameter '%s', available:\n", argv[i]);
+				param_list(stderr);
+				return 1;
+			}
+		}
+		else if (argv[i][0] != '-') controller_name = argv[i];
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!controller_select(controller_name)) {
+		fprintf(stderr, "Unknown controller '%s', available:\n", controller_name);
+		controller_list(stderr);
+		return 1;
+	}
+
+	// Empty map and trajectory, module state from a clean start
+	sim_context_init(&default_context);
+	sim_modules_reset();
+
+	if (headless)
+		return run_headless(laps, seconds, start_x, start_y, start_angle, output);
+
 	init_allegro();
 
 	init_bitmaps();
 	update_screen();
 
-	// Initialize the periodic task system (using SCHED_OTHER)
-	ptask_init(SCHED_OTHER);
+#ifdef LATTICE_PLANNER
+	lattice_init(LATTICE_WORKERS);
+#endif /* LATTICE_PLANNER */
+
+	// Initialize the periodic task system (SCHED_OTHER unless --sched). On the virtual
+	// clock the tasks run one job at a time, as fast as possible, in the same order on every run
+	if (virtual_clock) ptask_set_clock(PTASK_CLOCK_VIRTUAL);
+	ptask_init(policy);
+
+	// Budgets under SCHED_DEADLINE (--sched edf)
+	task_set_runtime_us(PERCEPTION_TASK, PERCEPTION_RUNTIME_US);
+	task_set_runtime_us(TRAJECTORY_TASK, TRAJECTORY_RUNTIME_US);
+	task_set_runtime_us(CONTROL_TASK, CONTROL_RUNTIME_US);
+	task_set_runtime_us(DISPLAY_TASK, DISPLAY_RUNTIME_US);
+	task_set_runtime_us(RACELINE_TASK, RACELINE_RUNTIME_US);
+
+	// Activation graph: one plan per scan, end-to-end deadline on the control jobs
+	connect_tasks();
 
-	// Create periodic tasks: perception, trajectory, control, display
+	// CPU budgets: an overrunning perception or raceline job does not delay the control loop
+	set_task_budgets();
 
-	if (task_create(1, perception_task, PERCEPTION_PERIOD, PERCEPTION_DEADLINE, PERCEPTION_PRIORITY, ACT) != 0) {
+	// Known-size prefaulted stacks, peak usage reported at exit
+	set_task_stacks();
+
+	// --rt-start: no page fault in the jobs, memory locked, heap prefaulted, tasks warmed up
+	if (rt_start) {
+		ptask_lock_memory(RT_HEAP_PREFAULT);
+		prepare_tasks_realtime();
+	}
+
+	// --pin: one CPU per task, on the isolated CPUs (isolcpus=) if any, else on the CPUs of the process
+	// (--cyclic: the executive alone on the first one)
+	if (pin || cyclic) {
+		cpu_set_t cpus;
+		if (ptask_isolated_cpus(&cpus) == 0)
+			sched_getaffinity(0, sizeof(cpus), &cpus);
+		pin_tasks(&cpus);
+	}
+
+#ifdef PROFILING
+	// Job start/end of every task: binary for profiler/gantt.py, or Chrome trace JSON (--trace file.json)
+	if (trace_open(trace_file) == 0) {
+		for (int task = cyclic ? EXECUTIVE_TASK : PERCEPTION_TASK; task < N_SIM_TASKS; task++)
+			trace_add_task(task, task_names[task]);
+		trace_start();
+	}
+#endif /* PROFILING */
+
+	// Create periodic tasks: perception, trajectory, control, display, raceline
+	// (--cyclic: control runs inline in the executive task, frame by frame)
+	if (cyclic) {
+		long frame_us = setup_cyclic_executive();
+		if (frame_us == 0 || task_create_us(EXECUTIVE_TASK, executive_task, frame_us, frame_us, EXECUTIVE_PRIORITY, ACT) != 0) {
+			fprintf(stderr, "Failed to create the cyclic executive\n");
+			exit(EXIT_FAILURE);
+		}
+		printf("Cyclic executive: %ld us frames, %d per hyperperiod\n", frame_us, cyclic_frames());
+	}
+	else if (task_create_us(CONTROL_TASK, control_task, CONTROL_PERIOD_US, CONTROL_DEADLINE_US, CONTROL_PRIORITY, ACT) != 0) {
+		fprintf(stderr, "Failed to create Control Task\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (task_create(PERCEPTION_TASK, perception_task, PERCEPTION_PERIOD, PERCEPTION_DEADLINE, PERCEPTION_PRIORITY, ACT) != 0) {
 		fprintf(stderr, "Failed to create Perception Task\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if (task_create(2, trajectory_task, TRAJECTORY_PERIOD, TRAJECTORY_DEADLINE, TRAJECTORY_PRIORITY, ACT) != 0) {
+	if (task_create(TRAJECTORY_TASK, trajectory_task, TRAJECTORY_PERIOD, TRAJECTORY_DEADLINE, TRAJECTORY_PRIORITY, DEACT) != 0) {
 		fprintf(stderr, "Failed to create Trajectory Task\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if (task_create(3, control_task, CONTROL_PERIOD, CONTROL_DEADLINE, CONTROL_PRIORITY, ACT) != 0) {
-		fprintf(stderr, "Failed to create Control Task\n");
+	if (task_create(DISPLAY_TASK, display_task, DISPLAY_PERIOD, DISPLAY_DEADLINE, DISPLAY_PRIORITY, ACT) != 0) {
+		fprintf(stderr, "Failed to create Display Task\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if (task_create(4, display_task, DISPLAY_PERIOD, DISPLAY_DEADLINE, DISPLAY_PRIORITY, ACT) != 0) {
-		fprintf(stderr, "Failed to create Display Task\n");
+	if (task_create(RACELINE_TASK, raceline_task, RACELINE_PERIOD, RACELINE_DEADLINE, RACELINE_PRIORITY, ACT) != 0) {
+		fprintf(stderr, "Failed to create Raceline Task\n");
 		exit(EXIT_FAILURE);
 	}
 
+	ptask_start();
+	print_placement();
+
+	// Every task has run its warm-up by now (task_create() waits for it)
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	long startup_faults = usage.ru_minflt + usage.ru_majflt;
+
 	// Wait for tasks to terminate (they will exit when ESC is pressed)
-	wait_for_task_end(1);
-	wait_for_task_end(2);
-	wait_for_task_end(3);
-	wait_for_task_end(4);
+	if (cyclic) wait_for_task_end(EXECUTIVE_TASK);
+	for (int task = PERCEPTION_TASK; task < N_SIM_TASKS; task++)
+		wait_for_task_end(task);
+	trace_close();
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Page faults after start-up: %ld (all threads)\n", usage.ru_minflt + usage.ru_majflt - startup_faults);
+
+#ifdef LATTICE_PLANNER
+	lattice_shutdown();
+#endif /* LATTICE_PLANNER */
+	print_stats();
+	print_task_stats(cyclic);
+#ifdef JITTER_MEASUREMENT
+	print_control_jitter();
+#endif /* JITTER_MEASUREMENT */
 
 	printf("Exiting simulation...\n");
 	clear_keybuf();
@@ -70,6 +230,65 @@ int main(void)
 	return 0;
 }
 
+void usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [controller] [--track file.yaml] [--set name=value]... [--virtual-clock] [--trace file[.json]]\n"
+					"       [--sched other|rm|edf] [--pin] [--rt-start] [--cyclic]\n"
+					"       [--headless [--laps N] [--seconds S] [--start x,y,deg] [--output file]]\n", program);
+	fprintf(stderr, "Controllers:\n");
+	controller_list(stderr);
+	fprintf(stderr, "Parameters:\n");
+	param_list(stderr);
+}
+
+// Same jobs on simulated time, no window: only the track bitmap (read by the lidar) is created
+int run_headless(int laps, float seconds, float start_x, float start_y, int start_angle, const char *output)
+{
+	allegro_init();
+	set_color_depth(32);
+	init_colors();
+	init_track();
+
+#ifdef LATTICE_PLANNER
+	lattice_init(LATTICE_WORKERS);
+#endif /* LATTICE_PLANNER */
+
+	int completed = headless_run(laps, seconds, start_x, start_y, start_angle, output);
+
+#ifdef LATTICE_PLANNER
+	lattice_shutdown();
+#endif /* LATTICE_PLANNER */
+	print_stats();
+
+	allegro_exit();
+	return (completed < 0 || completed < laps) ? 1 : 0;
+}
+
+void print_stats()
+{
+#ifdef LATTICE_PLANNER
+	lattice_print_stats();
+#else
+	trajectory_print_stats();
+#endif /* LATTICE_PLANNER */
+	controller_print_stats();
+	mpc_print_stats();
+}
+
+// Release latency, response time, CPU time and deadline misses of every job, measured by ptask
+void print_task_stats(int cyclic)
+{
+	for (int task = cyclic ? EXECUTIVE_TASK : PERCEPTION_TASK; task < N_SIM_TASKS; task++) {
+		printf("%s: %s\n", task_names[task], ptask_policy_name(task_policy(task)));
+		task_print_stats(task, task_names[task]);
+
+		// Canary overwritten in the last quarter: the stack size in globals.h leaves too little margin
+		if (task_stack_peak(task) > task_stack_size(task) / 4 * 3)
+			printf("Warning: %s used %zu of its %zu KB of stack\n", task_names[task],
+				task_stack_peak(task) / 1024, task_stack_size(task) / 1024);
+	}
+}
+
 
 void init_allegro()
 {
@@ -80,13 +299,7 @@ void init_allegro()
 	// Initialize the graphics mode
 	set_color_depth(32); // set the color depth to 8 bits for each of the RGB channels and 8 bits for the alpha channel (faster than 24 bit since it is aligned to 32 bits)
 
-	// Colors
-	grass_green = makecol(78,91,49); // army_green
-	asphalt_gray = makecol(128,126,120); // asphalt
-	white = makecol(255, 255, 255); // white
-	pink = makecol(255, 0, 255); // pink
-	yellow = makecol(254, 221, 0); // yellow for cones
-	blue = makecol(46, 103, 248); // blue for cones
+	init_colors();
 	
 	set_gfx_mode(GFX_AUTODETECT_WINDOWED, X_MAX, Y_MAX, 0, 0);
 	
@@ -96,6 +309,17 @@ void init_allegro()
 	clear_to_color(screen, pink); // clear the screen making all pixels to white
 }
 
+void init_colors()
+{
+	// Colors
+	grass_green = makecol(78,91,49); // army_green
+	asphalt_gray = makecol(128,126,120); // asphalt
+	white = makecol(255, 255, 255); // white
+	pink = makecol(255, 0, 255); // pink
+	yellow = makecol(254, 221, 0); // yellow for cones
+	blue = makecol(46, 103, 248); // blue for cones
+}
+
 void init_track()
 {
 	track = create_bitmap(X_MAX, Y_MAX);
@@ -207,7 +431,7 @@ void update_screen()
 			steering_wheel, 
 			100, 
 			100, 
-			ftofix(angle_rotation_sprite((int)(steering) / deg2rad)),  // deg to fixed point
+			ftofix(angle_rotation_sprite((int)(default_context.steering) / deg2rad)),  // deg to fixed point
 			ftofix(0.5)
 		);
 
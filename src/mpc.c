@@ -0,0 +1,376 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "globals.h"
+#include "trajectory.h"
+#include "control.h"
+#include "vehicle.h"
+#include "velocity.h"
+#include "mpc.h"
+#include "sim_context.h"
+#include "controller.h"
+#include "trace.h"
+
+/*
+	Linear MPC on the kinematic limit of the vehicle_model() bicycle, predicted with steps of MPC_DT.
+
+	Longitudinal:	v_(k+1) = (1 - dt g/m) v_k + (dt g vmax/m) p_k		throttle (p > 0)
+					v_(k+1) = v_k + (dt bmax/m) v_k p_k					brake (p <= 0)
+	Lateral, linearized around the reference path (u = tan(steering)):
+		e_(k+1)   = e_k + v_k dt psi_k						lateral error, left positive
+		psi_(k+1) = psi_k + (v_k dt/L) u_k - dpsi_ref_k		heading error
+
+	Both are condensed into QPs on the inputs only (states are affine in the
+	inputs), with box constraints on the inputs. The QPs are solved with an
+	accelerated projected gradient, warm started from the previous solution
+	shifted by one step. Everything is sized by MPC_HORIZON at compile time.
+*/
+
+#define N MPC_HORIZON
+
+// ---------------- Problem data ----------------
+// Rebuilt by every solve: one copy per thread, the warm start is in the context
+static __thread float	H[N][N], f[N];			// condensed cost 1/2 u'Hu + f'u
+static __thread float	sens_a[N], sens_b[N];	// sensitivities of the predicted outputs to the inputs
+static __thread float	ref_heading[N+1], ref_speed[N+1];
+static __thread float	pred_speed[N+1];
+static __thread float	pedal_lo[N], pedal_hi[N], steer_lo[N], steer_hi[N];
+
+static mpc_stats_t	mpc_stats;
+
+float	mpc_w_lateral = MPC_W_LATERAL;
+float	mpc_w_heading = MPC_W_HEADING;
+float	mpc_w_steer_rate = MPC_W_STEER_RATE;
+float	mpc_w_speed = MPC_W_SPEED;
+
+
+static float wrap_angle(float angle)
+{
+	while (angle > M_PI)	angle -= 2.0f * M_PI;
+	while (angle < -M_PI)	angle += 2.0f * M_PI;
+	return angle;
+}
+
+static float clampf(float v, float lo, float hi)
+{
+	return (v < lo) ? lo : ((v > hi) ? hi : v);
+}
+
+static float segment_heading(waypoint *path, int seg)
+{
+	return atan2f(-(path[seg+1].y - path[seg].y), path[seg+1].x - path[seg].x);
+}
+
+// ---------------- Condensed QP ----------------
+
+static void qp_reset(void)
+{
+	memset(H, 0, sizeof(H));
+	memset(f, 0, sizeof(f));
+}
+
+// Adds w * (sens' u + free - ref)^2 to the cost
+static void qp_add_output(const float *sens, float free, float ref, float weight)
+{
+	for (int i = 0; i < N; i++)
+	{
+		if (sens[i] == 0.0f) continue;
+		for (int j = 0; j < N; j++)
+			H[i][j] += weight * sens[i] * sens[j];
+		f[i] += weight * sens[i] * (free - ref);
+	}
+}
+
+// Adds w_u * u_k^2 + w_du * (u_k - u_(k-1))^2, with u_(-1) the last applied input
+static void qp_add_input_cost(float w_u, float w_du, float u_applied)
+{
+	for (int k = 0; k < N; k++)
+	{
+		H[k][k] += w_u + w_du;
+		if (k > 0) {
+			H[k][k-1] -= w_du;
+			H[k-1][k] -= w_du;
+			H[k-1][k-1] += w_du;
+		}
+	}
+	f[0] -= w_du * u_applied;
+}
+
+// Accelerated projected gradient on lo <= u <= hi; u holds the warm start. Returns the iterations,
+// counts the solves stopped by MPC_MAX_ITER in limit_hits.
+static int qp_solve(float *u, const float *lo, const float *hi, int *limit_hits)
+{
+	float lipschitz = 0.0f;	// Gershgorin bound on the largest eigenvalue of H
+	for (int i = 0; i < N; i++)
+	{
+		float row = 0.0f;
+		for (int j = 0; j < N; j++) row += fabsf(H[i][j]);
+		if (row > lipschitz) lipschitz = row;
+	}
+	if (lipschitz < 1e-9f) return 0;
+
+	float y[N], u_next[N];
+	float t = 1.0f;
+
+	for (int i = 0; i < N; i++) {
+		u[i] = clampf(u[i], lo[i], hi[i]);
+		y[i] = u[i];
+	}
+
+	for (int it = 1; it <= MPC_MAX_ITER; it++)
+	{
+		float max_step = 0.0f;
+
+		for (int i = 0; i < N; i++)
+		{
+			float grad = f[i];
+			for (int j = 0; j < N; j++) grad += H[i][j] * y[j];
+			u_next[i] = clampf(y[i] - grad / lipschitz, lo[i], hi[i]);
+			max_step = fmaxf(max_step, fabsf(u_next[i] - u[i]));
+		}
+
+		float t_next = 0.5f * (1.0f + sqrtf(1.0f + 4.0f * t * t));
+		for (int i = 0; i < N; i++)
+		{
+			y[i] = u_next[i] + (t - 1.0f) / t_next * (u_next[i] - u[i]);
+			u[i] = u_next[i];
+		}
+		t = t_next;
+
+		if (max_step < MPC_TOL) return it;
+	}
+
+	(*limit_hits)++;
+	return MPC_MAX_ITER;
+}
+
+// ---------------- Reference ----------------
+
+// Samples heading and speed of the path every pred_speed[k] * dt from the projection (seg, dist)
+static void sample_reference(waypoint *path, float *speed, int n_points, int seg, float dist)
+{
+	for (int k = 0; k <= N; k++)
+	{
+		if (k > 0)
+		{
+			dist += fmaxf(pred_speed[k-1], MPC_MIN_SPEED) * MPC_DT;
+			float len = hypotf(path[seg+1].x - path[seg].x, path[seg+1].y - path[seg].y);
+			while (seg < n_points - 2 && dist > len)
+			{
+				dist -= len;
+				seg++;
+				len = hypotf(path[seg+1].x - path[seg].x, path[seg+1].y - path[seg].y);
+			}
+		}
+
+		float len = hypotf(path[seg+1].x - path[seg].x, path[seg+1].y - path[seg].y);
+		float t = (len > 1e-6f) ? clampf(dist / len, 0.0f, 1.0f) : 0.0f;
+
+		ref_heading[k] = segment_heading(path, seg);
+		ref_speed[k] = (1.0f - t) * speed[seg] + t * speed[seg+1];
+	}
+}
+
+// Speeds of vehicle_model() under the current pedal plan
+static void predict_speed(const mpc_state_t *warm, float v0)
+{
+	pred_speed[0] = v0;
+	for (int k = 0; k < N; k++)
+	{
+		float v = pred_speed[k];
+		if (warm->u_pedal[k] > 0.0f)
+			pred_speed[k+1] = v + VEHICLE_DRIVE_GAIN * (warm->u_pedal[k] * VEHICLE_MAX_SPEED - v) / VEHICLE_MASS * MPC_DT;
+		else
+			pred_speed[k+1] = v + warm->u_pedal[k] * VEHICLE_MAX_BRAKING * v / VEHICLE_MASS * MPC_DT;
+	}
+}
+
+// ---------------- Controller ----------------
+
+void	mpc_control(sim_context *ctx, float *car_x, float *car_y, int *car_angle, trajectory_snapshot_t *path)
+{
+	mpc_state_t *warm = &ctx->mpc;
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	waypoint *trajectory = path->points;
+	int n_points = path->n_points;
+
+	if (n_points < 2) {
+		ctx->pedal = 0.0f;
+		ctx->steering = 0.0f;
+		return;
+	}
+
+	// 1) Projection of the car on the path
+	int nearest = 0;
+	float min_dist = INFINITY;
+	for (int i = 0; i < n_points; i++)
+	{
+		float d = hypotf(trajectory[i].x - *car_x, trajectory[i].y - *car_y);
+		if (d < min_dist) { min_dist = d; nearest = i; }
+	}
+
+	int seg = (nearest < n_points - 1) ? nearest : n_points - 2;
+	float sx = trajectory[seg+1].x - trajectory[seg].x, sy = trajectory[seg+1].y - trajectory[seg].y;
+	float len2 = sx * sx + sy * sy;
+	float proj = (len2 > 1e-12f) ? ((*car_x - trajectory[seg].x) * sx + (*car_y - trajectory[seg].y) * sy) / len2 : 0.0f;
+	if (proj < 0.0f && seg > 0)
+	{
+		seg--;
+		sx = trajectory[seg+1].x - trajectory[seg].x;
+		sy = trajectory[seg+1].y - trajectory[seg].y;
+		len2 = sx * sx + sy * sy;
+		proj = (len2 > 1e-12f) ? ((*car_x - trajectory[seg].x) * sx + (*car_y - trajectory[seg].y) * sy) / len2 : 0.0f;
+	}
+	proj = clampf(proj, 0.0f, 1.0f);
+
+	float path_heading = segment_heading(trajectory, seg);
+	float foot_x = trajectory[seg].x + proj * sx, foot_y = trajectory[seg].y + proj * sy;
+	float e0 = -(*car_x - foot_x) * sinf(path_heading) - (*car_y - foot_y) * cosf(path_heading);
+	float psi0 = wrap_angle(vehicle_yaw(ctx, *car_angle) - path_heading);
+	float dist0 = proj * sqrtf(len2);
+
+	// 2) Warm start: previous solutions, shifted once every MPC_DT of control ticks
+	if (++warm->ticks >= MPC_SHIFT_TICKS)
+	{
+		warm->ticks = 0;
+		for (int k = 0; k < N - 1; k++) {
+			warm->u_steer[k] = warm->u_steer[k+1];
+			warm->u_pedal[k] = warm->u_pedal[k+1];
+		}
+	}
+
+	float v0 = vehicle_speed(ctx);
+
+	// 3) Longitudinal QP, reference sampled along the warm-start speeds.
+	// Each step is linearized on the branch of vehicle_model() it is expected
+	// to use: throttle where the warm start is below the reference, brake above.
+	predict_speed(warm, v0);
+	sample_reference(trajectory, path->speed, n_points, seg, dist0);
+
+	float free = v0;
+
+	qp_reset();
+	memset(sens_a, 0, sizeof(sens_a));
+	for (int k = 0; k < N; k++)
+	{
+		float alpha, beta, gamma;
+
+		if (pred_speed[k+1] > ref_speed[k+1] + MPC_BRAKE_MARGIN)
+		{
+			// v' = v + c v p, linearized around the warm start (v_k, p_k)
+			const float c = MPC_DT * VEHICLE_MAX_BRAKING / VEHICLE_MASS;
+			float p_hat = fminf(warm->u_pedal[k], 0.0f);
+			alpha = 1.0f + c * p_hat;
+			beta = c * pred_speed[k];
+			gamma = -c * pred_speed[k] * p_hat;
+			pedal_lo[k] = -1.0f;
+			pedal_hi[k] = 0.0f;
+		}
+		else
+		{
+			// v' = (1 - dt g/m) v + (dt g vmax/m) p
+			alpha = 1.0f - MPC_DT * VEHICLE_DRIVE_GAIN / VEHICLE_MASS;
+			beta = MPC_DT * VEHICLE_DRIVE_GAIN * VEHICLE_MAX_SPEED / VEHICLE_MASS;
+			gamma = 0.0f;
+			pedal_lo[k] = 0.0f;
+			pedal_hi[k] = 1.0f;
+		}
+
+		for (int j = 0; j < k; j++) sens_a[j] *= alpha;
+		sens_a[k] = beta;
+		free = alpha * free + gamma;
+		qp_add_output(sens_a, free, ref_speed[k+1], mpc_w_speed);
+	}
+	qp_add_input_cost(MPC_W_PEDAL, MPC_W_PEDAL_RATE, warm->last_pedal);
+	int limit_hits = 0;
+	int iterations = qp_solve(warm->u_pedal, pedal_lo, pedal_hi, &limit_hits);
+
+	// 4) Lateral QP, reference resampled along the new speed plan
+	predict_speed(warm, v0);
+	sample_reference(trajectory, path->speed, n_points, seg, dist0);
+
+	float free_e = e0, free_psi = psi0;
+
+	qp_reset();
+	memset(sens_a, 0, sizeof(sens_a));	// lateral error
+	memset(sens_b, 0, sizeof(sens_b));	// heading error
+	for (int k = 0; k < N; k++)
+	{
+		float v_dt = fmaxf(pred_speed[k], MPC_MIN_SPEED) * MPC_DT;	// also the yaw gain v dt / L
+
+		for (int j = 0; j < k; j++) sens_a[j] += v_dt * sens_b[j];
+		free_e += v_dt * free_psi;
+
+		sens_b[k] = v_dt / VEHICLE_WHEELBASE;
+		free_psi -= wrap_angle(ref_heading[k+1] - ref_heading[k]);
+
+		qp_add_output(sens_a, free_e, 0.0f, mpc_w_lateral);
+		qp_add_output(sens_b, free_psi, 0.0f, mpc_w_heading);
+	}
+	qp_add_input_cost(MPC_W_STEER, mpc_w_steer_rate, warm->last_steer);
+	for (int k = 0; k < N; k++) {
+		steer_lo[k] = -tanf(VEHICLE_MAX_STEERING);
+		steer_hi[k] = tanf(VEHICLE_MAX_STEERING);
+	}
+	iterations += qp_solve(warm->u_steer, steer_lo, steer_hi, &limit_hits);
+
+	// 5) Apply the first inputs
+	warm->last_pedal = warm->u_pedal[0];
+	warm->last_steer = warm->u_steer[0];
+	ctx->pedal = warm->last_pedal;
+	ctx->steering = atanf(warm->last_steer);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	long solve_us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000;
+
+	if (!ctx->warmup)
+	{
+		mpc_stats.solves++;
+		mpc_stats.iterations += iterations;
+		mpc_stats.max_iter_hits += limit_hits;
+		mpc_stats.last_iterations = iterations;
+		mpc_stats.last_solve_us = solve_us;
+		mpc_stats.total_solve_us += solve_us;
+		if (solve_us > mpc_stats.max_solve_us) mpc_stats.max_solve_us = solve_us;
+		trace_mpc_solve(iterations, solve_us);	// to the trace of the calling task, if traced
+	}
+}
+
+// Fresh start: no warm start from a previous drive
+static void mpc_reset(sim_context *ctx)
+{
+	mpc_state_t *warm = &ctx->mpc;
+
+	memset(warm->u_steer, 0, sizeof(warm->u_steer));
+	memset(warm->u_pedal, 0, sizeof(warm->u_pedal));
+	warm->last_steer = ctx->steering;
+	warm->last_pedal = ctx->pedal;
+	warm->ticks = 0;
+}
+
+const controller_t mpc_controller = {
+	.name = "mpc",
+	.budget_us = MPC_BUDGET_US,
+	.init = NULL,
+	.step = mpc_control,
+	.reset = mpc_reset,
+};
+
+void	mpc_get_stats(mpc_stats_t *stats)
+{
+	*stats = mpc_stats;
+}
+
+void	mpc_print_stats()
+{
+	if (mpc_stats.solves == 0) return;
+
+	printf("MPC (horizon %d): %ld solves, %.1f iterations/solve, %ld hit the iteration limit\n",
+		N, mpc_stats.solves, (double)mpc_stats.iterations / mpc_stats.solves, mpc_stats.max_iter_hits);
+	printf("  solve time: mean %.1f us, max %ld us\n",
+		(double)mpc_stats.total_solve_us / mpc_stats.solves, mpc_stats.max_solve_us);
+}
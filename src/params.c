@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "params.h"
+#include "perception.h"
+#include "control.h"
+#include "mpc.h"
+#include "headless.h"
+
+// ---------------- Registry ----------------
+static const param_t params[] = {
+	{ "detections_threshold",	PARAM_INT,		&detections_threshold,	"detections before a cone enters the map" },
+	{ "lidar_resolution",		PARAM_FLOAT,	&distance_resolution,	"LiDAR range step [m]" },
+	{ "lidar_angle_step",		PARAM_INT,		&angle_step,			"LiDAR angular step [deg]" },
+	{ "pp_lookahead_min",		PARAM_FLOAT,	&pp_lookahead_min,		"pure pursuit lookahead at standstill [m]" },
+	{ "pp_lookahead_gain",		PARAM_FLOAT,	&pp_lookahead_gain,		"pure pursuit lookahead per unit of speed [s]" },
+	{ "mpc_w_lateral",			PARAM_FLOAT,	&mpc_w_lateral,			"MPC lateral error weight" },
+	{ "mpc_w_heading",			PARAM_FLOAT,	&mpc_w_heading,			"MPC heading error weight" },
+	{ "mpc_w_steer_rate",		PARAM_FLOAT,	&mpc_w_steer_rate,		"MPC steering rate weight" },
+	{ "mpc_w_speed",			PARAM_FLOAT,	&mpc_w_speed,			"MPC speed error weight" },
+	{ "perception_period",		PARAM_INT,		&headless_perception_period,	"headless perception period [ms]" },
+	{ "trajectory_deadline",	PARAM_INT,		&headless_trajectory_deadline,	"headless trajectory deadline after each scan [ms]" },
+	{ "trajectory_period",		PARAM_INT,		&headless_trajectory_deadline,	"old name of trajectory_deadline" },
+	{ "raceline_period",		PARAM_INT,		&headless_raceline_period,		"headless raceline period [ms]" },
+};
+#define N_PARAMS	((int)(sizeof(params) / sizeof(params[0])))
+
+
+int		param_set(const char *assignment)
+{
+	const char *equal = strchr(assignment, '=');
+	if (equal == NULL || equal[1] == '\0') return 0;
+
+	size_t name_length = equal - assignment;
+	for (int i = 0; i < N_PARAMS; i++)
+	{
+		if (strlen(params[i].name) != name_length || strncmp(params[i].name, assignment, name_length) != 0)
+			continue;
+
+		char *end;
+		if (params[i].type == PARAM_INT) {
+			long v = strtol(equal + 1, &end, 10);
+			if (*end != '\0' || v <= 0) return 0;
+			*(int *)params[i].value = (int)v;
+		}
+		else {
+			float v = strtof(equal + 1, &end);
+			if (*end != '\0' || v <= 0.0f) return 0;
+			*(float *)params[i].value = v;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+void	param_list(FILE *out)
+{
+	for (int i = 0; i < N_PARAMS; i++)
+	{
+		if (params[i].type == PARAM_INT)
+			fprintf(out, "  %-22s %-8d %s\n", params[i].name, *(int *)params[i].value, params[i].description);
+		else
+			fprintf(out, "  %-22s %-8g %s\n", params[i].name, *(float *)params[i].value, params[i].description);
+	}
+}
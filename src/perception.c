@@ -4,24 +4,26 @@
 
 #include "globals.h"
 #include "perception.h"
+#include "boundaries.h"
+#include "sim_context.h"
+#include "ptask.h"
 
 const int sliding_window = 360;
-const int angle_step = 1;
+int angle_step = 1;
 int start_angle = 0;
 
 const float ignore_distance = 0.5f;
-const float distance_resolution = 0.01f;
-cone detected_cones[MAX_DETECTED_CONES];
+float distance_resolution = 0.01f;
 
-int n_candidates = 0;
-candidate_cone candidates[MAX_CANDIDATES];
+int detections_threshold = DETECTIONS_THRESHOLD;
 
-int track_map_idx = 0;
-cone track_map[MAX_CONES_MAP];
+// Offsets of the 360 points of a circle of cone_radius, filled on the first mapping()
+static float circle_dx[360], circle_dy[360];
+static int circle_ready = 0;
 
 
 // LiDAR measures
-void 	check_nearest_point(int angle, float new_point_x, float new_point_y, int color, cone_border *cone_borders)
+void 	check_nearest_point(sim_context *ctx, int angle, float new_point_x, float new_point_y, int color, cone_border *cone_borders)
 {
 	// check if the point is near to a cone
 	for (int i = 0; i < MAX_DETECTED_CONES; i++)
@@ -45,8 +47,8 @@ void 	check_nearest_point(int angle, float new_point_x, float new_point_y, int c
 			int isPointOnCone = 0;		// flag to check if the point is near to a cone
 
 			while ((insertion_point < MAX_POINTS_PER_CONE-1) && (cone_borders[i].angles[insertion_point] != -1)){
-				float cone_point_x = measures[cone_borders[i].angles[insertion_point]].point_x;
-				float cone_point_y = measures[cone_borders[i].angles[insertion_point]].point_y;
+				float cone_point_x = ctx->measures[cone_borders[i].angles[insertion_point]].point_x;
+				float cone_point_y = ctx->measures[cone_borders[i].angles[insertion_point]].point_y;
 
 				float distance = sqrt(pow(new_point_x - cone_point_x, 2) + pow(new_point_y - cone_point_y, 2));
 
@@ -67,57 +69,41 @@ void 	check_nearest_point(int angle, float new_point_x, float new_point_y, int c
 	}
 }
 
-void    lidar(float car_x, float car_y, pointcloud_t *measures)
+void    lidar(sim_context *ctx, float car_x, float car_y)
 {
-	int stop_distance; 
+	pointcloud_t *measures = ctx->measures;
 
 	// Check for each angle in the range [0, 360] with a step of angle_step
 	for (int i = 0; i < sliding_window; i += angle_step)
 	{
 		int		lidar_angle = (start_angle + i)%360;
-		int 	current_distance = 0; // initialize distance at 0
+		float	ray_cos = cos((float)(lidar_angle) * deg2rad);
+		float	ray_sin = sin((float)(lidar_angle) * deg2rad);
 
 		// Initialize the measure with the maximum range and no color
 		measures[lidar_angle].distance = maxRange;
 		measures[lidar_angle].color = -1; // cone not detected
 
-		stop_distance = 0;
-
-		// Check each pixel in the range [0, maxRange] with a step of distance_resolution
+		// Check each pixel in the range [0, maxRange] with a step of distance_resolution,
+		// up to the first cone pixel
 		for (float distance = ignore_distance; distance < maxRange; distance += distance_resolution)
 		{
 			// Calculate the x and y coordinates of the pixel at the current distance and angle
-			float x = car_x + ( distance * cos((float)(lidar_angle) * deg2rad) );
-			float y = car_y + ( distance * sin((float)(lidar_angle) * deg2rad) );
+			float x = car_x + distance * ray_cos;
+			float y = car_y + distance * ray_sin;
 
 			int x_px = x * px_per_meter;
 			int y_px = y * px_per_meter;
+			int pixel = getpixel(track, x_px, y_px);
 
-			//putpixel(screen, x_px, y_px, makecol(255, 0, 0));
-
-			if (stop_distance != 1)
+			if (pixel == yellow || pixel == blue)
 			{
-				if (getpixel(track, x_px, y_px) == yellow) // yellow
-				{
-					// printf("Cone detected\n");
-					measures[lidar_angle].distance = distance; // convert to meters
-					measures[lidar_angle].color = yellow; // makecol(254, 221, 0); // yellow
-					measures[lidar_angle].point_x = x;
-					measures[lidar_angle].point_y = y;
-
-					stop_distance = 1;  // cone detected, stop the loop
-				}
-				else if (getpixel(track, x_px, y_px) == blue) // blue
-				{   
-					// printf("Cone detected\n");
-					measures[lidar_angle].distance = distance; // convert to meters
-					measures[lidar_angle].color = blue; // blue
-					measures[lidar_angle].point_x = x;
-					measures[lidar_angle].point_y = y;
-
-					stop_distance = 1;  // cone detected, stop the loop
-				}
-			}            
+				measures[lidar_angle].distance = distance;
+				measures[lidar_angle].color = pixel;
+				measures[lidar_angle].point_x = x;
+				measures[lidar_angle].point_y = y;
+				break;  // cone detected, stop the ray
+			}
 		}
 	}
 }
@@ -308,10 +294,20 @@ void mapping(float car_x, float car_y, int car_angle, cone *detected_cones)
 	update_map(detected_cones);
 }
 */
-void 	mapping(float car_x, float car_y, int car_angle, cone *detected_cones)
+void 	detect_cones(sim_context *ctx, float car_x, float car_y, int car_angle)
 {
+pointcloud_t *measures = ctx->measures;
+cone *detected_cones = ctx->detected_cones;
 cone_border cone_borders[MAX_DETECTED_CONES]; // maximum number of cones viewed at each position
 
+if (!circle_ready){
+	for (int i = 0; i < 360; i++){
+		circle_dx[i] = cone_radius * cos(i * deg2rad);
+		circle_dy[i] = cone_radius * sin(i * deg2rad);
+	}
+	circle_ready = 1;
+}
+
 // init cone borders
 for (int i = 0; i < MAX_DETECTED_CONES; i++){
 	for (int j = 0; j < MAX_POINTS_PER_CONE; j++){
@@ -331,7 +327,7 @@ for (int i = 0; i < MAX_DETECTED_CONES; i++){
 		}
 		else // a cone is detected at this angle
 		{
-			check_nearest_point(angle, measures[angle].point_x, measures[angle].point_y, measures[angle].color, cone_borders);
+			check_nearest_point(ctx, angle, measures[angle].point_x, measures[angle].point_y, measures[angle].color, cone_borders);
 		}
 
 	}
@@ -352,6 +348,10 @@ for (int i = 0; i < MAX_DETECTED_CONES; i++){
 	
 	// for each cone detected
 	while( (cone_idx < MAX_DETECTED_CONES-1) && (cone_borders[cone_idx].color != -1) ){
+		// CPU budget of the perception task used up: the centers found so far are mapped,
+		// the next scans see the other cones (the grouping above is complete, no border is cut)
+		if (ptask_budget_exhausted()) break;
+
 		int cone_cx = 0; // center of the cone
 		int cone_cy = 0;
 
@@ -397,8 +397,8 @@ for (int i = 0; i < MAX_DETECTED_CONES; i++){
 					cone first_point_circle[360];
 
 					for (int i = 0; i < 360; i++){
-						first_point_circle[i].x = measures[cone_borders[cone_idx].angles[0]].point_x + cone_radius * cos(i * deg2rad);
-						first_point_circle[i].y = measures[cone_borders[cone_idx].angles[0]].point_y + cone_radius * sin(i * deg2rad);
+						first_point_circle[i].x = measures[cone_borders[cone_idx].angles[0]].point_x + circle_dx[i];
+						first_point_circle[i].y = measures[cone_borders[cone_idx].angles[0]].point_y + circle_dy[i];
 						first_point_circle[i].color = measures[cone_borders[cone_idx].angles[0]].color;
 					}
 
@@ -408,24 +408,34 @@ for (int i = 0; i < MAX_DETECTED_CONES; i++){
 					// for all the angles that corresponds to a cone we need to calculate the center of the cone
 					float new_x, new_y, new_distance;
 
-					for (int i = 0; i < 360; i++){ // initialize the possible points
-						circumference_points[i].distance = 2*maxRange;
+					for (int i = 0; i < 360; i++){ // initialize the possible points (squared distances, only their order matters)
+						circumference_points[i].distance = 4*maxRange*maxRange;
 						circumference_points[i].x = 0;
 						circumference_points[i].y = 0;
 					}
 
 					for (int i = 0; i < 360; i++){
-						new_x = measures[cone_borders[cone_idx].angles[point_idx]].point_x + cone_radius * cos(i * deg2rad);
-						new_y = measures[cone_borders[cone_idx].angles[point_idx]].point_y + cone_radius * sin(i * deg2rad);
-
-						for (int j = 0; j < 360; j++){
-							new_distance = sqrt(pow(new_x - first_point_circle[j].x, 2) + pow(new_y - first_point_circle[j].y, 2));
+						new_x = measures[cone_borders[cone_idx].angles[point_idx]].point_x + circle_dx[i];
+						new_y = measures[cone_borders[cone_idx].angles[point_idx]].point_y + circle_dy[i];
+
+						// The closest of the 360 points of the first circle is the one at the angle
+						// of new_x, new_y seen from its center (+-1 for the rounding)
+						float first_x = measures[cone_borders[cone_idx].angles[0]].point_x;
+						float first_y = measures[cone_borders[cone_idx].angles[0]].point_y;
+						int nearest = (int)lroundf(atan2f(new_y - first_y, new_x - first_x) / deg2rad);
+
+						new_distance = circumference_points[i].distance;
+						for (int k = -1; k <= 1; k++){
+							int j = ((nearest + k) % 360 + 360) % 360;
+							float dx = new_x - first_point_circle[j].x, dy = new_y - first_point_circle[j].y;
+							float d = dx * dx + dy * dy;
+							new_distance = (d < new_distance) ? d : new_distance;
+						}
 
-							if (new_distance < circumference_points[i].distance){
-								circumference_points[i].distance = new_distance;
-								circumference_points[i].x = new_x;
-								circumference_points[i].y = new_y;
-							}
+						if (new_distance < circumference_points[i].distance){
+							circumference_points[i].distance = new_distance;
+							circumference_points[i].x = new_x;
+							circumference_points[i].y = new_y;
 						}
 					}
 				} 
@@ -440,24 +450,27 @@ for (int i = 0; i < MAX_DETECTED_CONES; i++){
 					// from the points of intersection found in the previous iteration (less overhead)
 					float new_x, new_y, new_distance;
 
-					for (int i = 0; i < 360; i++){ // initialize the possible points
-						circumference_points[i].distance = 2*maxRange;
+					for (int i = 0; i < 360; i++){ // initialize the possible points (squared distances, only their order matters)
+						circumference_points[i].distance = 4*maxRange*maxRange;
 						circumference_points[i].x = 0;
 						circumference_points[i].y = 0;
 					}
 
 					for (int i = 0; i < 360; i++){
-						new_x = measures[cone_borders[cone_idx].angles[point_idx]].point_x + cone_radius * cos(i * deg2rad);
-						new_y = measures[cone_borders[cone_idx].angles[point_idx]].point_y + cone_radius * sin(i * deg2rad);
-
-						for (int j = 0; j < 360; j++){
-							new_distance = sqrt(pow(new_x - possible_cone_centers[j].x, 2) + pow(new_y - possible_cone_centers[j].y, 2));
+						new_x = measures[cone_borders[cone_idx].angles[point_idx]].point_x + circle_dx[i];
+						new_y = measures[cone_borders[cone_idx].angles[point_idx]].point_y + circle_dy[i];
+
+						new_distance = circumference_points[i].distance;
+						for (int j = 0; j < possible_center_idx; j++){ // only the intersections found so far are set
+							float dx = new_x - possible_cone_centers[j].x, dy = new_y - possible_cone_centers[j].y;
+							float d = dx * dx + dy * dy;
+							new_distance = (d < new_distance) ? d : new_distance;
+						}
 
-							if (new_distance < circumference_points[i].distance){
-								circumference_points[i].distance = new_distance;
-								circumference_points[i].x = new_x;
-								circumference_points[i].y = new_y;
-							}
+						if (new_distance < circumference_points[i].distance){
+							circumference_points[i].distance = new_distance;
+							circumference_points[i].x = new_x;
+							circumference_points[i].y = new_y;
 						}
 					}
 
@@ -579,13 +592,20 @@ for (int i = 0; i < MAX_DETECTED_CONES; i++){
 
 		cone_idx++;
 	}
+}
 
-	update_map(detected_cones);	
+void 	mapping(sim_context *ctx, float car_x, float car_y, int car_angle)
+{
+	detect_cones(ctx, car_x, car_y, car_angle);
+	update_map(ctx);
 }
 
 // Update the map
-void update_map(cone *detected_cones) 
+void update_map(sim_context *ctx) 
 {
+	cone *detected_cones = ctx->detected_cones;
+	candidate_cone *candidates = ctx->candidates;
+
 	int N_new_detections = 0;
 	while (detected_cones[N_new_detections].color != -1) N_new_detections++; // count new detections
 
@@ -595,7 +615,7 @@ void update_map(cone *detected_cones)
 		int found = 0;
 		
 		// Check if detection matches any existing candidate
-		for (int i = 0; i < n_candidates; i++) 
+		for (int i = 0; i < ctx->n_candidates; i++) 
 		{
 			float distance = sqrt(pow(detected_cones[new_idx].x - candidates[i].x, 2) + 
 								pow(detected_cones[new_idx].y - candidates[i].y, 2));
@@ -603,19 +623,24 @@ void update_map(cone *detected_cones)
 			if (distance < 3 * cone_radius) 
 			{	
 				// Only update if we haven't reached the threshold yet
-				if (candidates[i].detections < DETECTIONS_THRESHOLD) 
+				if (candidates[i].detections < detections_threshold) 
 				{	// Update candidate position with moving average
 					candidates[i].x = (candidates[i].x * candidates[i].detections + detected_cones[new_idx].x) / (candidates[i].detections + 1);
 					candidates[i].y = (candidates[i].y * candidates[i].detections + detected_cones[new_idx].y) / (candidates[i].detections + 1);
 					candidates[i].detections++;
 					
 					// If threshold reached, add to map
-					if (candidates[i].detections == DETECTIONS_THRESHOLD) 
+					if (candidates[i].detections == detections_threshold) 
 					{
-						track_map[track_map_idx].x = candidates[i].x;
-						track_map[track_map_idx].y = candidates[i].y;
-						track_map[track_map_idx].color = candidates[i].color;
-						track_map_idx++;
+						if (ctx->track_map_idx < MAX_CONES_MAP)
+						{
+							ctx->track_map[ctx->track_map_idx].x = candidates[i].x;
+							ctx->track_map[ctx->track_map_idx].y = candidates[i].y;
+							ctx->track_map[ctx->track_map_idx].color = candidates[i].color;
+							ctx->track_map_idx++;
+
+							boundaries_add_cone(ctx->track_map, ctx->track_map_idx - 1);
+						}
 					}
 				}
 				
@@ -625,13 +650,15 @@ void update_map(cone *detected_cones)
 		}
 		
 		// If no matching candidate found, create new one
-		if (!found && n_candidates < MAX_CANDIDATES) 
+		if (!found && ctx->n_candidates < MAX_CANDIDATES) 
 		{
-			candidates[n_candidates].x = detected_cones[new_idx].x;
-			candidates[n_candidates].y = detected_cones[new_idx].y;
-			candidates[n_candidates].color = detected_cones[new_idx].color;
-			candidates[n_candidates].detections = 1;
-			n_candidates++;
+			candidates[ctx->n_candidates].x = detected_cones[new_idx].x;
+			candidates[ctx->n_candidates].y = detected_cones[new_idx].y;
+			candidates[ctx->n_candidates].color = detected_cones[new_idx].color;
+			candidates[ctx->n_candidates].detections = 1;
+			ctx->n_candidates++;
 		}
 	}
+
+	boundaries_publish(); // no-op if no cone was added
 }
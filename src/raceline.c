@@ -0,0 +1,386 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "globals.h"
+#include "perception.h"
+#include "trajectory.h"
+#include "raceline.h"
+#include "boundaries.h"
+
+/*
+	Minimum-curvature racing line.
+
+	The line is parametrized as p_i = c_i + a_i * n_i, where c_i are the centerline
+	midpoints and n_i the unit normals. The summed squared curvature is approximated
+	by the second differences of the points:
+
+		min  sum_i || p_(i-1) - 2 p_i + p_(i+1) ||^2		s.t.	lo_i <= a_i <= hi_i
+
+	which is a QP with a (cyclic) pentadiagonal Hessian H. It is solved with ADMM:
+	the x-update solves (H + rho*I) x = rhs with a banded Cholesky factorization
+	computed once per map version, so every iteration is O(n).
+
+	The cyclic corner entries of H only touch the last two rows of the lower
+	triangle, so the factor is stored as a 3-wide band for rows [0, n-3] plus two
+	dense rows for n-2 and n-1: factorization and solves stay O(n).
+*/
+
+// ---------------- Problem data (owned by the raceline task) ----------------
+static waypoint	center[MAX_RACELINE_POINTS];
+static waypoint	side_left[MAX_RACELINE_POINTS], side_right[MAX_RACELINE_POINTS];	// paired boundary points
+static float	normal_x[MAX_RACELINE_POINTS], normal_y[MAX_RACELINE_POINTS];
+static float	lat_lo[MAX_RACELINE_POINTS], lat_hi[MAX_RACELINE_POINTS];
+static double	grad[MAX_RACELINE_POINTS];
+static int		n_points = 0;
+static int		closed = 0;
+
+static double	L_band[MAX_RACELINE_POINTS][3];	// columns r-2, r-1, r
+static double	L_dense[2][MAX_RACELINE_POINTS];	// rows n-2, n-1
+
+// ADMM state (kept between calls for warm starts)
+static double	admm_x[MAX_RACELINE_POINTS], admm_z[MAX_RACELINE_POINTS], admm_u[MAX_RACELINE_POINTS];
+static int		converged = 0;
+static int		iterations = 0;
+static long		solve_us = 0;
+static int		last_map_idx = -1;
+static int		last_map_version = -1;
+
+// Last solution in world coordinates, used to warm start when the map changes
+static waypoint	prev_line[MAX_RACELINE_POINTS];
+static int		prev_n = 0;
+
+// ---------------- Published result ----------------
+static pthread_mutex_t	raceline_mutex = PTHREAD_MUTEX_INITIALIZER;
+static waypoint			published[MAX_RACELINE_POINTS];
+static int				published_n = 0;
+static raceline_stats_t	published_stats;
+
+
+static long elapsed_us(struct timespec *t0)
+{
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000000L + (t1.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+// First column stored for row r of the lower triangle
+static int row_start(int r)
+{
+	if (r >= n_points - 2) return 0;
+	return (r >= 2) ? r - 2 : 0;
+}
+
+// Entry (r, c) of the lower triangle, r >= c (NULL if outside the structure)
+static double *lower_entry(int r, int c)
+{
+	if (r >= n_points - 2) return &L_dense[r - (n_points - 2)][c];
+	if (r - c > 2) return NULL;
+	return &L_band[r][2 - (r - c)];
+}
+
+static void add_entry(int r, int c, double value)
+{
+	if (r < c) { int tmp = r; r = c; c = tmp; }
+	double *entry = lower_entry(r, c);
+	if (entry != NULL) *entry += value;
+}
+
+// In-place Cholesky factorization of the stored lower triangle
+static int factorize(void)
+{
+	for (int r = 0; r < n_points; r++)
+	{
+		for (int c = row_start(r); c <= r; c++)
+		{
+			double sum = *lower_entry(r, c);
+			int k_start = row_start(r) > row_start(c) ? row_start(r) : row_start(c);
+
+			for (int k = k_start; k < c; k++)
+				sum -= *lower_entry(r, k) * *lower_entry(c, k);
+
+			if (c == r)
+			{
+				if (sum <= 0.0) return 0; // not positive definite
+				*lower_entry(r, r) = sqrt(sum);
+			}
+			else
+				*lower_entry(r, c) = sum / *lower_entry(c, c);
+		}
+	}
+	return 1;
+}
+
+// Solves L L^T x = b (x and b may alias)
+static void solve(const double *b, double *x)
+{
+	for (int r = 0; r < n_points; r++)
+	{
+		double sum = b[r];
+		for (int k = row_start(r); k < r; k++)
+			sum -= *lower_entry(r, k) * x[k];
+		x[r] = sum / *lower_entry(r, r);
+	}
+
+	for (int c = n_points - 1; c >= 0; c--)
+	{
+		double sum = x[c];
+		// band rows below c, then the two dense rows
+		for (int r = c + 1; r <= c + 2 && r < n_points - 2; r++)
+			sum -= *lower_entry(r, c) * x[r];
+		for (int r = (c + 1 > n_points - 2) ? c + 1 : n_points - 2; r < n_points; r++)
+			sum -= *lower_entry(r, c) * x[r];
+		x[c] = sum / *lower_entry(c, c);
+	}
+}
+
+static float clampf(float v, float lo, float hi)
+{
+	return (v < lo) ? lo : ((v > hi) ? hi : v);
+}
+
+// Rebuilds the QP for a new map version; returns 0 if the map is not usable yet
+static int setup_problem(cone *track_map, int track_map_idx)
+{
+	static track_boundaries boundaries; // refreshed only when the map version changes
+	waypoint raw[2*MAX_DETECTED_CONES], raw_left[2*MAX_DETECTED_CONES], raw_right[2*MAX_DETECTED_CONES];
+
+	// Centerline and corridor from the boundary polylines, or from cone pairing
+	boundaries_get(&boundaries);
+	int n_raw = boundaries_centerline(&boundaries, raw, raw_left, raw_right, 2*MAX_DETECTED_CONES);
+	int use_boundaries = (n_raw >= 6);
+
+	if (!use_boundaries)
+		n_raw = build_centerline(track_map, track_map_idx, raw);
+
+	// Merge points closer than RACELINE_MIN_SPACING
+	n_points = 0;
+	for (int i = 0; i < n_raw && n_points < MAX_RACELINE_POINTS; i++)
+	{
+		if (n_points > 0 && hypotf(raw[i].x - center[n_points-1].x, raw[i].y - center[n_points-1].y) < RACELINE_MIN_SPACING)
+			continue;
+		if (use_boundaries) {
+			side_left[n_points] = raw_left[i];
+			side_right[n_points] = raw_right[i];
+		}
+		center[n_points++] = raw[i];
+	}
+	if (n_points < 6) {
+		n_points = 0;
+		return 0;
+	}
+
+	if (use_boundaries)
+		closed = boundaries.closed[BOUNDARY_LEFT] && boundaries.closed[BOUNDARY_RIGHT];
+	else
+	{
+		// The lap is closed if the chaining came back next to its starting point
+		float mean_spacing = 0.0f;
+		for (int i = 1; i < n_points; i++)
+			mean_spacing += hypotf(center[i].x - center[i-1].x, center[i].y - center[i-1].y);
+		mean_spacing /= (n_points - 1);
+
+		closed = hypotf(center[0].x - center[n_points-1].x, center[0].y - center[n_points-1].y) < 3.0f * mean_spacing;
+	}
+
+	// Unit normals from the central difference of the neighbours
+	for (int i = 0; i < n_points; i++)
+	{
+		int prev = (i > 0) ? i - 1 : (closed ? n_points - 1 : 0);
+		int next = (i < n_points - 1) ? i + 1 : (closed ? 0 : n_points - 1);
+		float tx = center[next].x - center[prev].x;
+		float ty = center[next].y - center[prev].y;
+		float norm = hypotf(tx, ty);
+		if (norm < 1e-6f) { tx = 1.0f; ty = 0.0f; norm = 1.0f; }
+		normal_x[i] = -ty / norm;
+		normal_y[i] =  tx / norm;
+	}
+
+	// Corridor: lateral position of the paired boundary points (or of the nearest blue and yellow cones)
+	for (int i = 0; i < n_points; i++)
+	{
+		float min_dist_b = INFINITY, min_dist_y = INFINITY;
+		float lat_b = 0.0f, lat_y = 0.0f;
+
+		if (use_boundaries)
+		{
+			min_dist_b = min_dist_y = 0.0f;
+			lat_b = (side_left[i].x - center[i].x) * normal_x[i] + (side_left[i].y - center[i].y) * normal_y[i];
+			lat_y = (side_right[i].x - center[i].x) * normal_x[i] + (side_right[i].y - center[i].y) * normal_y[i];
+		}
+		else for (int j = 0; j < track_map_idx; j++)
+		{
+			float dx = track_map[j].x - center[i].x;
+			float dy = track_map[j].y - center[i].y;
+			float dist = dx * dx + dy * dy;
+
+			if (track_map[j].color == blue && dist < min_dist_b) {
+				min_dist_b = dist;
+				lat_b = dx * normal_x[i] + dy * normal_y[i];
+			}
+			else if (track_map[j].color == yellow && dist < min_dist_y) {
+				min_dist_y = dist;
+				lat_y = dx * normal_x[i] + dy * normal_y[i];
+			}
+		}
+
+		if (min_dist_b == INFINITY) lat_b = -lat_y; // one side only: assume a symmetric corridor
+		if (min_dist_y == INFINITY) lat_y = -lat_b;
+
+		lat_lo[i] = fminf(lat_b, lat_y) + RACELINE_MARGIN;
+		lat_hi[i] = fmaxf(lat_b, lat_y) - RACELINE_MARGIN;
+		if (lat_lo[i] > lat_hi[i]) lat_lo[i] = lat_hi[i] = 0.0f; // too narrow: stay on the centerline
+	}
+
+	if (!closed) {
+		lat_lo[0] = lat_hi[0] = 0.0f; // open path: keep the endpoints on the centerline
+		lat_lo[n_points-1] = lat_hi[n_points-1] = 0.0f;
+	}
+
+	// Assemble H + rho*I and the linear term g
+	memset(L_band, 0, sizeof(L_band));
+	memset(L_dense, 0, sizeof(L_dense));
+	memset(grad, 0, sizeof(grad));
+
+	const float w[3] = {1.0f, -2.0f, 1.0f};
+
+	for (int i = (closed ? 0 : 1); i < (closed ? n_points : n_points - 1); i++)
+	{
+		int k[3] = {(i + n_points - 1) % n_points, i, (i + 1) % n_points};
+
+		float dx = center[k[0]].x - 2.0f * center[k[1]].x + center[k[2]].x;
+		float dy = center[k[0]].y - 2.0f * center[k[1]].y + center[k[2]].y;
+
+		for (int a = 0; a < 3; a++)
+		{
+			grad[k[a]] += w[a] * (dx * normal_x[k[a]] + dy * normal_y[k[a]]);
+
+			for (int b = 0; b <= a; b++)
+			{
+				float dot = normal_x[k[a]] * normal_x[k[b]] + normal_y[k[a]] * normal_y[k[b]];
+				add_entry(k[a], k[b], w[a] * w[b] * dot);
+			}
+		}
+	}
+
+	for (int i = 0; i < n_points; i++)
+		add_entry(i, i, RACELINE_RHO);
+
+	if (!factorize()) {
+		fprintf(stderr, "Raceline: factorization failed (%d points)\n", n_points);
+		n_points = 0;
+		return 0;
+	}
+
+	// Warm start from the previous line, projected on the new normals
+	for (int i = 0; i < n_points; i++)
+	{
+		float offset = 0.0f;
+
+		if (prev_n > 0)
+		{
+			float min_dist = INFINITY;
+			int nearest = 0;
+			for (int j = 0; j < prev_n; j++)
+			{
+				float dist = hypotf(prev_line[j].x - center[i].x, prev_line[j].y - center[i].y);
+				if (dist < min_dist) { min_dist = dist; nearest = j; }
+			}
+			offset = (prev_line[nearest].x - center[i].x) * normal_x[i] + (prev_line[nearest].y - center[i].y) * normal_y[i];
+		}
+
+		admm_z[i] = clampf(offset, lat_lo[i], lat_hi[i]);
+		admm_u[i] = 0.0;
+	}
+
+	converged = 0;
+	iterations = 0;
+	solve_us = 0;
+	return 1;
+}
+
+static void publish(void)
+{
+	for (int i = 0; i < n_points; i++)
+	{
+		prev_line[i].x = center[i].x + admm_z[i] * normal_x[i];
+		prev_line[i].y = center[i].y + admm_z[i] * normal_y[i];
+	}
+	prev_n = n_points;
+
+	pthread_mutex_lock(&raceline_mutex);
+		memcpy(published, prev_line, n_points * sizeof(waypoint));
+		published_n = n_points;
+		published_stats.n_solves++;
+		published_stats.n_points = n_points;
+		published_stats.closed = closed;
+		published_stats.converged = converged;
+		published_stats.last_iterations = iterations;
+		published_stats.last_solve_us = solve_us;
+	pthread_mutex_unlock(&raceline_mutex);
+}
+
+void	raceline_optimize(cone *track_map, int track_map_idx, int map_version)
+{
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	if (track_map_idx != last_map_idx || map_version != last_map_version)
+	{
+		if (map_version != last_map_version) prev_n = 0;	// another map: no warm start
+		last_map_idx = track_map_idx;
+		last_map_version = map_version;
+		if (!setup_problem(track_map, track_map_idx)) return;
+	}
+
+	if (n_points == 0 || converged) return; // nothing new to do
+
+	double rhs[MAX_RACELINE_POINTS];
+
+	for (int iter = 0; iter < RACELINE_MAX_ITER && !converged; iter++)
+	{
+		for (int i = 0; i < n_points; i++)
+			rhs[i] = RACELINE_RHO * (admm_z[i] - admm_u[i]) - grad[i];
+
+		solve(rhs, admm_x);
+
+		double primal = 0.0, dual = 0.0;
+		for (int i = 0; i < n_points; i++)
+		{
+			double z_old = admm_z[i];
+			admm_z[i] = clampf(admm_x[i] + admm_u[i], lat_lo[i], lat_hi[i]);
+			admm_u[i] += admm_x[i] - admm_z[i];
+
+			primal = fmax(primal, fabs(admm_x[i] - admm_z[i]));
+			dual = fmax(dual, RACELINE_RHO * fabs(admm_z[i] - z_old));
+		}
+		iterations++;
+
+		converged = (primal < RACELINE_TOL && dual < RACELINE_TOL);
+	}
+
+	solve_us += elapsed_us(&t0);
+	publish();
+}
+
+int		raceline_get(waypoint *raceline, int max_points)
+{
+	if (pthread_mutex_trylock(&raceline_mutex) != 0) return -1;
+
+		int n = (published_n < max_points) ? published_n : max_points;
+		memcpy(raceline, published, n * sizeof(waypoint));
+
+	pthread_mutex_unlock(&raceline_mutex);
+	return n;
+}
+
+int		raceline_get_stats(raceline_stats_t *stats)
+{
+	if (pthread_mutex_trylock(&raceline_mutex) != 0) return -1;
+
+		*stats = published_stats;
+
+	pthread_mutex_unlock(&raceline_mutex);
+	return 0;
+}
@@ -0,0 +1,44 @@
+#include <string.h>
+
+#include "globals.h"
+#include "sim_context.h"
+#include "boundaries.h"
+#include "trajectory.h"
+
+sim_context	default_context;
+
+// Legacy globals: the arrays of the default pipeline
+pointcloud_t	*const measures = default_context.measures;
+cone			*const detected_cones = default_context.detected_cones;
+cone			*const track_map = default_context.track_map;
+waypoint		*const trajectory = default_context.trajectory;
+float			*const speed_profile = default_context.velocity.speed;
+
+
+static int	n_maps = 0;		// atomic: contexts can be initialized from any thread
+
+
+void	sim_context_init(sim_context *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->map_version = __atomic_add_fetch(&n_maps, 1, __ATOMIC_RELAXED);	// same track_map_idx, different map
+
+	for (int i = 0; i < MAX_DETECTED_CONES; i++)
+	{
+		ctx->measures[i].color = -1;
+		ctx->detected_cones[i].x = -1;
+		ctx->detected_cones[i].y = -1;
+		ctx->detected_cones[i].color = -1;
+	}
+	ctx->trajectory[0].x = -1;
+	ctx->trajectory[0].y = -1;
+
+	ctx->controller_idx = -1;	// the first step resets its controller
+	ctx->pursuit.idx = -1;
+}
+
+void	sim_modules_reset()
+{
+	boundaries_reset();
+	trajectory_publish_snapshot(NULL, 0, NULL);	// no plan for the controller
+}
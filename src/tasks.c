@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "globals.h"	// for shared globals
 #include "tasks.h"
@@ -6,7 +9,283 @@
 #include "trajectory.h"	// for trajectory planning
 #include "vehicle.h"	// to control the vehicle + vehicle model
 #include "display.h"	// to draw on screen
+#include "raceline.h"	// for the background racing line optimizer
+#include "velocity.h"	// for the speed profile
+#include "lattice.h"	// for the lattice local planner
+#include "controller.h"	// for the controller plug-ins
+#include "sim_context.h"	// for the default pipeline
 #include "ptask.h"		// for periodic tasks
+#include "trace.h"		// for the job trace
+
+const char *const task_names[N_SIM_TASKS] = {
+	"EXECUTIVE", "PERCEPTION", "TRAJ_PLANNING", "CONTROL", "DISPLAY", "RACELINE"
+};
+
+static long	executive_frame_us;	// minor frame of the cyclic executive, 0 without it
+
+int		pin_tasks(const cpu_set_t *cpus)
+{
+	int list[CPU_SETSIZE], n = 0, next = 0;
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, cpus)) list[n++] = cpu;
+	if (n == 0) return 0;
+
+	for (int task = EXECUTIVE_TASK; task < N_SIM_TASKS; task++)
+	{
+		cpu_set_t one;
+		CPU_ZERO(&one);
+		if (task == CONTROL_TASK || task == EXECUTIVE_TASK || n == 1)
+			CPU_SET(list[0], &one);
+		else
+			CPU_SET(list[1 + next++ % (n - 1)], &one);
+		task_set_affinity(task, &one);
+	}
+	return n;
+}
+
+// Warm-ups: the code paths of the jobs on a heap copy of the default pipeline
+// marked ctx->warmup, so that the map, the plan, the car, the controller state
+// and the statistics are the same before and after
+static sim_context *warmup_copy(void)
+{
+	sim_context *ctx = malloc(sizeof(*ctx));
+
+	if (ctx == NULL) return NULL;
+	*ctx = default_context;
+	ctx->warmup = 1;
+	return ctx;
+}
+
+static void perception_warmup(void)
+{
+	sim_context *ctx = warmup_copy();
+	if (ctx == NULL) return;
+
+	lidar(ctx, car_x, car_y);
+	detect_cones(ctx, car_x, car_y, car_angle);	// not mapped
+	free(ctx);
+}
+
+static void trajectory_warmup(void)
+{
+	sim_context *ctx = warmup_copy();
+	timespec_custom deadline;
+	if (ctx == NULL) return;
+
+	ptask_gettime(&deadline);
+	time_add_us(&deadline, task_deadline_us(TRAJECTORY_TASK));
+#ifdef LATTICE_PLANNER
+	lattice_planning(ctx, car_x, car_y, car_angle);
+#else
+	trajectory_planning(ctx, car_x, car_y, car_angle, &deadline);
+#endif /* LATTICE_PLANNER */
+	velocity_profile(ctx, vehicle_speed(ctx));	// not published
+	free(ctx);
+}
+
+static void control_warmup(void)
+{
+	static trajectory_snapshot_t path;	// empty plan
+	sim_context *ctx = warmup_copy();
+	float x = car_x, y = car_y;
+	int angle = car_angle;
+	if (ctx == NULL) return;
+
+	controller_warmup(ctx, &x, &y, &angle, &path);	// the autonomous controller, the heavier path
+	free(ctx);
+}
+
+void	connect_tasks()
+{
+	// One plan per scan, as soon as the scan is mapped
+	task_precedence(PERCEPTION_TASK, TRAJECTORY_TASK, PTASK_EDGE_TRIGGER);
+	// The control loop integrates the vehicle model at its own period: it samples the last plan
+	task_precedence(TRAJECTORY_TASK, CONTROL_TASK, PTASK_EDGE_SAMPLE);
+	task_set_e2e_deadline_us(CONTROL_TASK, PIPELINE_E2E_DEADLINE_US);
+}
+
+void	set_task_budgets()
+{
+	task_set_budget_us(PERCEPTION_TASK, PERCEPTION_BUDGET_US, PTASK_BUDGET_STOP);	// see mapping()
+	task_set_budget_us(RACELINE_TASK, RACELINE_BUDGET_US, PTASK_BUDGET_DEMOTE);
+}
+
+void	set_task_stacks()
+{
+	task_set_stack_size(PERCEPTION_TASK, PERCEPTION_STACK_SIZE);
+	task_set_stack_size(TRAJECTORY_TASK, TASK_STACK_SIZE);
+	task_set_stack_size(CONTROL_TASK, TASK_STACK_SIZE);
+	task_set_stack_size(DISPLAY_TASK, TASK_STACK_SIZE);
+	task_set_stack_size(RACELINE_TASK, TASK_STACK_SIZE);
+}
+
+void	prepare_tasks_realtime()
+{
+	task_set_warmup(PERCEPTION_TASK, perception_warmup);
+	task_set_warmup(TRAJECTORY_TASK, trajectory_warmup);
+	task_set_warmup(CONTROL_TASK, control_warmup);
+	task_set_warmup(DISPLAY_TASK, update_display);	// draws the current state, as its first job would
+	// None for the raceline task: an iteration of the optimizer cannot be undone
+	task_set_warmup(EXECUTIVE_TASK, control_warmup);	// the only job of the executive
+}
+
+// CPU list in the kernel format, "0-3,6"
+static void format_cpus(const cpu_set_t *cpus, char *text, size_t size)
+{
+	size_t length = 0;
+	text[0] = '\0';
+
+	for (int cpu = 0; cpu < CPU_SETSIZE && length < size; cpu++)
+	{
+		if (!CPU_ISSET(cpu, cpus)) continue;
+
+		int last = cpu;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus)) last++;
+
+		if (last == cpu)
+			length += snprintf(text + length, size - length, "%s%d", length ? "," : "", cpu);
+		else
+			length += snprintf(text + length, size - length, "%s%d-%d", length ? "," : "", cpu, last);
+		cpu = last;
+	}
+}
+
+void	print_placement()
+{
+	char cpus_text[64];
+
+	printf("Task placement (%ld CPUs online):\n", sysconf(_SC_NPROCESSORS_ONLN));
+	for (int task = executive_frame_us ? EXECUTIVE_TASK : PERCEPTION_TASK; task < N_SIM_TASKS; task++)
+	{
+		cpu_set_t cpus;
+		if (task_get_affinity(task, &cpus) != 0) continue;
+
+		format_cpus(&cpus, cpus_text, sizeof(cpus_text));
+		printf("  %-13s CPU %s\n", task_names[task], cpus_text);
+	}
+}
+
+// Jobs: one activation of each task on the default pipeline, also run on simulated time by headless.c
+void perception_job()
+{
+	sim_context *ctx = &default_context;
+	int map_size = ctx->track_map_idx;
+
+	lidar(ctx, car_x, car_y);
+
+	for (int i = 0; i < MAX_DETECTED_CONES; i++){
+		ctx->detected_cones[i].x = -1;
+		ctx->detected_cones[i].y = -1;
+		ctx->detected_cones[i].color = -1;
+	}
+
+	mapping(ctx, car_x, car_y, car_angle);
+
+	if (ctx->track_map_idx != map_size)
+		trace_map_update(ctx->track_map_idx);
+}
+
+void trajectory_job(timespec_custom *deadline)
+{
+	sim_context *ctx = &default_context;
+
+#ifdef LATTICE_PLANNER
+	lattice_planning(ctx, car_x, car_y, car_angle);
+#else
+	trajectory_planning(ctx, car_x, car_y, car_angle, deadline);
+#endif /* LATTICE_PLANNER */
+	velocity_profile(ctx, vehicle_speed(ctx));
+	trajectory_publish_snapshot(ctx->trajectory, ctx->trajectory_idx, ctx->velocity.speed);
+}
+
+void control_job(int autonomous)
+{
+	static trajectory_snapshot_t path;	// last complete plan, the planner is never waited for
+
+	trajectory_get_snapshot(&path);
+	controller_step(&default_context, autonomous, &car_x, &car_y, &car_angle, &path);
+}
+
+void raceline_job()
+{
+	// track_map is append-only: the first track_map_idx cones are stable
+	raceline_optimize(default_context.track_map, default_context.track_map_idx, default_context.map_version);
+}
+
+#ifdef JITTER_MEASUREMENT
+static struct {
+	long	jobs;
+	long	latency_max_us, latency_sum_us;		// start time - release time
+	long	interval_max_us, interval_sum_us;	// |start-to-start interval - period|
+	long	prev_start_us;
+} jitter;
+
+static long now_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000L + t.tv_nsec / 1000;
+}
+
+// Release of the current job: its absolute deadline minus the relative one
+// (threads and cyclic jobs alike, the executive does not advance the next activation)
+static void record_jitter(int task_id)
+{
+	timespec_custom deadline;
+	long start = now_us();
+
+	task_adline(task_id, &deadline);
+	long release = deadline.tv_sec * 1000000L + deadline.tv_nsec / 1000 - task_deadline_us(task_id);
+	long latency = start - release;
+
+	jitter.latency_sum_us += latency;
+	if (latency > jitter.latency_max_us) jitter.latency_max_us = latency;
+
+	if (jitter.jobs > 0)
+	{
+		long deviation = labs(start - jitter.prev_start_us - task_period_us(task_id));
+		jitter.interval_sum_us += deviation;
+		if (deviation > jitter.interval_max_us) jitter.interval_max_us = deviation;
+	}
+	jitter.prev_start_us = start;
+	jitter.jobs++;
+}
+
+void	print_control_jitter()
+{
+	if (jitter.jobs < 2) return;
+
+	printf("Control loop at %ld us: %ld jobs\n", (long)CONTROL_PERIOD_US, jitter.jobs);
+	printf("  release latency: mean %.1f us, max %ld us\n",
+		(double)jitter.latency_sum_us / jitter.jobs, jitter.latency_max_us);
+	printf("  period jitter:   mean %.1f us, max %ld us\n",
+		(double)jitter.interval_sum_us / (jitter.jobs - 1), jitter.interval_max_us);
+}
+#endif /* JITTER_MEASUREMENT */
+
+// Job of the cyclic executive: the body of the control task, without the loop
+static void control_cyclic_job(void)
+{
+#ifdef JITTER_MEASUREMENT
+	record_jitter(CONTROL_TASK);
+#endif /* JITTER_MEASUREMENT */
+	trace_job_start(CONTROL_TASK);
+	control_job(key[KEY_A]);
+	trace_job_end(CONTROL_TASK);
+}
+
+// The 1 ms frame set by the control loop is shorter than a perception job
+// (~4 ms), a planning job and a frame of the display: these stay threads,
+// preempted by the executive, and cyclic_build() would reject them
+long	setup_cyclic_executive()
+{
+	cyclic_job(CONTROL_TASK, control_cyclic_job, CONTROL_PERIOD_US, CONTROL_DEADLINE_US, CONTROL_RUNTIME_US);
+
+	task_set_stack_size(EXECUTIVE_TASK, TASK_STACK_SIZE);
+	executive_frame_us = cyclic_build();
+	return executive_frame_us;
+}
 
 // Periodic task functions (using ptask.h notation)
 void *perception_task(void *arg)
@@ -16,23 +295,15 @@ void *perception_task(void *arg)
 
 	while (!key[KEY_ESC])
 	{
-		runtime(0, "PERCEPTION");
-		
-		lidar(car_x, car_y, measures);
-
-		for (int i = 0; i < MAX_DETECTED_CONES; i++){
-			detected_cones[i].x = -1;
-			detected_cones[i].y = -1;
-			detected_cones[i].color = -1;
-		}
+		trace_job_start(task_id);
 
-		mapping(car_x, car_y, car_angle, detected_cones); // Pass the address of first element
-		sem_post(&lidar_sem);
+		perception_job();
 
-		runtime(1, "PERCEPTION");
+		trace_job_end(task_id);
 
-		wait_for_period(task_id);
+		wait_for_period(task_id);	// activates the trajectory task
 	}
+	task_activate(TRAJECTORY_TASK);	// the trajectory task waits for a scan: let it see ESC
 	return NULL;
 }
 
@@ -43,12 +314,14 @@ void *trajectory_task(void *arg)
 
 	while (!key[KEY_ESC])
 	{
-		runtime(0, "TRAJ_PLANNING");
+		trace_job_start(task_id);
 
-		sem_wait(&lidar_sem);
-		trajectory_planning(car_x, car_y, car_angle, detected_cones, trajectory);
+		// Released by the end of the scan: the deadline counts from it
+		timespec_custom deadline;
+		task_adline(task_id, &deadline);
+		trajectory_job(&deadline);
 
-		runtime(1, "TRAJ_PLANNING");
+		trace_job_end(task_id);
 
 		wait_for_period(task_id);
 	}
@@ -62,16 +335,15 @@ void *control_task(void *arg)
 
     while (!key[KEY_ESC])
     {
-		runtime(0, "CONTROL");
+#ifdef JITTER_MEASUREMENT
+		record_jitter(task_id);
+#endif /* JITTER_MEASUREMENT */
+		trace_job_start(task_id);
 
-		if (!key[KEY_A]){
-        	keyboard_control(&car_x, &car_y, &car_angle);
-		}
-		else
-			autonomous_control(&car_x, &car_y, &car_angle, trajectory);
-		
+		// Keyboard unless A is held, then the controller selected at startup
+		control_job(key[KEY_A]);
 
-		runtime(1, "CONTROL");
+		trace_job_end(task_id);
 
         wait_for_period(task_id);
     }
@@ -85,14 +357,49 @@ void *display_task(void *arg)
 
 	while (!key[KEY_ESC])
 	{
-		runtime(0, "DISPLAY");
+		trace_job_start(task_id);
 
 		update_display();
 		
-		runtime(1, "DISPLAY");
+		trace_job_end(task_id);
 
 		wait_for_period(task_id);
 
 	}
 	return NULL;
 }
+
+void *executive_task(void *arg)
+{
+	int task_id = get_task_index(arg);
+	wait_for_activation(task_id);
+
+	while (!key[KEY_ESC])
+	{
+		// Late frames run back to back: every job runs, as in the threaded mode
+		trace_job_start(task_id);
+		cyclic_frame(task_id);
+		trace_job_end(task_id);
+
+		wait_for_period(task_id);
+	}
+	return NULL;
+}
+
+void *raceline_task(void *arg)
+{
+	int task_id = get_task_index(arg);
+	wait_for_activation(task_id);
+
+	while (!key[KEY_ESC])
+	{
+		trace_job_start(task_id);
+
+		raceline_job();
+
+		trace_job_end(task_id);
+
+		wait_for_period(task_id);
+	}
+	return NULL;
+}
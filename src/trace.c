@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "ptask.h"
+
+#define RING_MASK	(TRACE_RING_RECORDS - 1)
+
+// Head and tail on their own cache lines: the producer and the drain thread never share one for writing
+typedef struct {
+	_Alignas(64) atomic_uint	head;		// next record to write (producer)
+	_Alignas(64) atomic_uint	tail;		// next record to drain (drain thread)
+	_Alignas(64) unsigned long	dropped;	// producer only, read after the tasks ended
+	uint32_t		job;
+	trace_record_t	records[TRACE_RING_RECORDS];
+} trace_ring_t;
+
+static trace_ring_t	*rings[MAX_TASKS];
+static char			names[MAX_TASKS][TRACE_NAME_LENGTH];
+static char			labels[TRACE_MAX_LABELS][TRACE_NAME_LENGTH];
+
+static FILE			*out = NULL;
+static const char	*out_path = NULL;
+static long			written = 0;
+static int			json = 0;			// Chrome trace-event JSON instead of binary records
+static uint64_t		json_t0_ns;			// ptask_t0: time 0 of the JSON timeline
+
+static __thread int	self = -1;			// task of the calling thread, from its last trace_job_start()
+
+static pthread_t	drain_tid;
+static atomic_int	draining = 0;
+
+
+int		trace_open(const char *path)
+{
+	out = fopen(path, "wb");
+	if (out == NULL) {
+		perror(path);
+		return -1;
+	}
+	out_path = path;
+
+	size_t length = strlen(path);
+	json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+	return 0;
+}
+
+int		trace_add_task(int task, const char *name)
+{
+	if (out == NULL || task < 0 || task >= MAX_TASKS || rings[task] != NULL) return -1;
+
+	trace_ring_t *ring = aligned_alloc(64, sizeof(trace_ring_t));
+	if (ring == NULL) return -1;
+
+	// Touch the whole ring now: no page fault on the producer side
+	memset(ring, 0, sizeof(trace_ring_t));
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+
+	snprintf(names[task], TRACE_NAME_LENGTH, "%s", name);
+	rings[task] = ring;
+	return 0;
+}
+
+int		trace_add_label(int label, const char *name)
+{
+	if (label < 0 || label >= TRACE_MAX_LABELS) return -1;
+
+	snprintf(labels[label], TRACE_NAME_LENGTH, "%s", name);
+	return 0;
+}
+
+static trace_ring_t *ring_of(int task)
+{
+	return (task >= 0 && task < MAX_TASKS) ? rings[task] : NULL;
+}
+
+// Producer side: no lock, the record is published by the release store of head
+static void trace_event(trace_ring_t *ring, int task, int event, int arg, uint32_t value0, uint32_t value1,
+						const timespec_custom *now)
+{
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == TRACE_RING_RECORDS) {
+		ring->dropped++;
+		return;
+	}
+
+	trace_record_t *record = &ring->records[head & RING_MASK];
+	record->time_ns = (uint64_t)now->tv_sec * 1000000000ULL + now->tv_nsec;
+	record->job = ring->job;
+	record->task = (uint8_t)task;
+	record->event = (uint8_t)event;
+	record->arg = (uint16_t)arg;
+	record->value[0] = value0;
+	record->value[1] = value1;
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void trace_event_now(int task, int event, int arg, uint32_t value0, uint32_t value1)
+{
+	trace_ring_t *ring = ring_of(task);
+	if (ring == NULL) return;
+
+	timespec_custom now;
+	ptask_gettime(&now);
+	trace_event(ring, task, event, arg, value0, value1, &now);
+}
+
+void	trace_job_start(int task)
+{
+	trace_ring_t *ring = ring_of(task);
+	if (ring == NULL) return;
+
+	self = task;
+	ring->job++;
+
+	timespec_custom now;
+	ptask_gettime(&now);
+	trace_event(ring, task, TRACE_JOB_START, 0, 0, 0, &now);
+}
+
+void	trace_job_end(int task)
+{
+	trace_ring_t *ring = ring_of(task);
+	if (ring == NULL) return;
+
+	timespec_custom now, deadline;
+	ptask_gettime(&now);
+	trace_event(ring, task, TRACE_JOB_END, 0, 0, 0, &now);
+
+	task_adline(task, &deadline);
+	if (time_cmp(now, deadline) > 0)
+		trace_event(ring, task, TRACE_DEADLINE_MISS, 0, 0, 0, &now);
+}
+
+void	trace_map_update(int cones)
+{
+	trace_event_now(self, TRACE_MAP_UPDATE, cones, 0, 0);
+}
+
+void	trace_mpc_solve(int iterations, long solve_us)
+{
+	trace_event_now(self, TRACE_MPC_SOLVE, 0, (uint32_t)iterations, (uint32_t)solve_us);
+}
+
+void	trace_overrun(int controller_label, long cpu_us, long budget_us)
+{
+	trace_event_now(self, TRACE_OVERRUN, controller_label, (uint32_t)cpu_us, (uint32_t)budget_us);
+}
+
+// One Chrome trace event per record: jobs are B/E slices on the track of the task
+static void write_json(const trace_record_t *record)
+{
+	double ts = (double)(int64_t)(record->time_ns - json_t0_ns) * 1e-3;
+	int tid = record->task;
+
+	switch (record->event)
+	{
+		case TRACE_JOB_START:
+			fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"job\":%u}}",
+				names[tid], tid, ts, record->job);
+			break;
+		case TRACE_JOB_END:
+			fprintf(out, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", tid, ts);
+			break;
+		case TRACE_DEADLINE_MISS:
+			fprintf(out, ",\n{\"name\":\"deadline miss\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"job\":%u}}",
+				tid, ts, record->job);
+			break;
+		case TRACE_MAP_UPDATE:
+			fprintf(out, ",\n{\"name\":\"map update\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"cones\":%u}}",
+				tid, ts, record->arg);
+			break;
+		case TRACE_MPC_SOLVE:
+			fprintf(out, ",\n{\"name\":\"mpc solve\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"iterations\":%u,\"solve_us\":%u}}",
+				tid, ts, record->value[0], record->value[1]);
+			break;
+		case TRACE_OVERRUN:
+			fprintf(out, ",\n{\"name\":\"overrun\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"controller\":\"%s\",\"cpu_us\":%u,\"budget_us\":%u}}",
+				tid, ts, record->arg < TRACE_MAX_LABELS ? labels[record->arg] : "", record->value[0], record->value[1]);
+			break;
+	}
+}
+
+static void write_records(const trace_record_t *records, unsigned count)
+{
+	if (!json) {
+		fwrite(records, sizeof(trace_record_t), count, out);
+		return;
+	}
+	for (unsigned i = 0; i < count; i++)
+		write_json(&records[i]);
+}
+
+// Consumer side: writes the records published so far, then frees their slots
+static void drain_rings(void)
+{
+	for (int t = 0; t < MAX_TASKS; t++)
+	{
+		trace_ring_t *ring = rings[t];
+		if (ring == NULL) continue;
+
+		unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		unsigned count = head - tail;
+		if (count == 0) continue;
+
+		// At most two chunks: up to the end of the buffer, then from its start
+		unsigned first = tail & RING_MASK;
+		unsigned chunk = (count < TRACE_RING_RECORDS - first) ? count : TRACE_RING_RECORDS - first;
+		write_records(&ring->records[first], chunk);
+		if (count > chunk)
+			write_records(&ring->records[0], count - chunk);
+
+		atomic_store_explicit(&ring->tail, head, memory_order_release);
+		written += count;
+	}
+}
+
+static void *drain_thread(void *arg)
+{
+	// Lowest priority: nice 19 under SCHED_OTHER, below every task
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+
+	struct timespec period = { 0, TRACE_DRAIN_PERIOD_US * 1000L };
+
+	while (atomic_load(&draining))
+	{
+		drain_rings();
+		nanosleep(&period, NULL);
+	}
+	return NULL;
+}
+
+void	trace_start()
+{
+	if (out == NULL) return;
+
+	if (json) {
+		// Every event starts with ",\n": the metadata comes first, one name per track
+		json_t0_ns = (uint64_t)ptask_t0.tv_sec * 1000000000ULL + ptask_t0.tv_nsec;
+		fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+					 "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"2D_sim\"}}");
+		for (int t = 0; t < MAX_TASKS; t++)
+		{
+			if (rings[t] == NULL) continue;
+			fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", t, names[t]);
+			fprintf(out, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", t, t);
+		}
+	}
+	else {
+		trace_header_t header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+		header.record_size = sizeof(trace_record_t);
+		header.n_tasks = MAX_TASKS;
+		memcpy(header.names, names, sizeof(names));
+		header.n_labels = TRACE_MAX_LABELS;
+		memcpy(header.labels, labels, sizeof(labels));
+		fwrite(&header, sizeof(header), 1, out);
+	}
+
+	atomic_store(&draining, 1);
+	if (pthread_create(&drain_tid, NULL, drain_thread, NULL) != 0) {
+		perror("trace drain thread");
+		atomic_store(&draining, 0);
+	}
+}
+
+void	trace_close()
+{
+	if (out == NULL) return;
+
+	if (atomic_load(&draining)) {
+		atomic_store(&draining, 0);
+		pthread_join(drain_tid, NULL);
+	}
+	drain_rings();
+	if (json) fprintf(out, "\n]}\n");
+	fclose(out);
+	out = NULL;
+
+	long dropped = 0;
+	for (int t = 0; t < MAX_TASKS; t++)
+	{
+		if (rings[t] == NULL) continue;
+		dropped += rings[t]->dropped;
+		free(rings[t]);
+		rings[t] = NULL;
+	}
+	printf("Trace: %ld records written to %s, %ld dropped (full ring)\n", written, out_path, dropped);
+}
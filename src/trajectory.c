@@ -1,24 +1,26 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "trajectory.h"
 #include "globals.h"
 #include "perception.h"
+#include "boundaries.h"
+#include "sim_context.h"
 
-int trajectory_idx = 0;
-waypoint trajectory[2*MAX_DETECTED_CONES];
+static pthread_mutex_t			stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static planner_stats_t			planner_stats;	// written by the trajectory task, read under stats_mutex
 
-void 	trajectory_planning(float car_x, float car_y, float car_angle, cone *detected_cones, waypoint *trajectory)
+static pthread_mutex_t			snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trajectory_snapshot_t	snapshot;
+
+// Pair each cone of the map with its nearest opposite-colour cone and return
+// the ordered midpoints (nearest-neighbour chaining) in centerline.
+int 	build_centerline(cone *track_map, int track_map_idx, waypoint *centerline)
 {
-	// Initialize trajectory points to invalid values
-	for (int i = 0; i < MAX_DETECTED_CONES; i++) {
-		trajectory[i].x = -1;
-		trajectory[i].y = -1;
-	}
-	
 	if (track_map_idx < 3) {
-		return; // Not enough cones in map to plan trajectory
+		return 0; // Not enough cones in map to plan trajectory
 	}
 
 	int connected_indices[track_map_idx][2];
@@ -116,38 +118,38 @@ void 	trajectory_planning(float car_x, float car_y, float car_angle, cone *detec
 #endif
 
 	// Generate trajectory points from cone connections
-	trajectory_idx = 0;
-	for (int i = 0; i < track_map_idx && trajectory_idx < MAX_DETECTED_CONES; i++) {
+	int n_points = 0;
+	for (int i = 0; i < track_map_idx && n_points < MAX_DETECTED_CONES; i++) {
 		int opposite_color_idx = track_map[i].color == yellow ? B_idx : Y_idx;
 		
 		if (connected_indices[i][opposite_color_idx] != -1) {
-			trajectory[trajectory_idx].x = (track_map[i].x + track_map[connected_indices[i][opposite_color_idx]].x) / 2;
-			trajectory[trajectory_idx].y = (track_map[i].y + track_map[connected_indices[i][opposite_color_idx]].y) / 2;
-			trajectory_idx++;
+			centerline[n_points].x = (track_map[i].x + track_map[connected_indices[i][opposite_color_idx]].x) / 2;
+			centerline[n_points].y = (track_map[i].y + track_map[connected_indices[i][opposite_color_idx]].y) / 2;
+			n_points++;
 		}
 	}
 
 	// Reorder trajectory points based on proximity
-	if (trajectory_idx > 1) 
+	if (n_points > 1) 
 	{
 		waypoint temp[MAX_DETECTED_CONES];
 		int used[MAX_DETECTED_CONES] = {0};
 		
 		// Copy first point
-		temp[0] = trajectory[0];
+		temp[0] = centerline[0];
 		used[0] = 1;
 
 		// Find nearest points iteratively
-		for (int i = 1; i < trajectory_idx; i++) 
+		for (int i = 1; i < n_points; i++) 
 		{
 			float min_dist = INFINITY;
 			int min_idx = -1;
 
-			for (int j = 0; j < trajectory_idx; j++) 
+			for (int j = 0; j < n_points; j++) 
 			{
 				if (!used[j]) 
 				{
-					float dist = sqrt(pow(temp[i-1].x - trajectory[j].x, 2) + pow(temp[i-1].y - trajectory[j].y, 2));
+					float dist = sqrt(pow(temp[i-1].x - centerline[j].x, 2) + pow(temp[i-1].y - centerline[j].y, 2));
 					if (dist < min_dist) 
 					{
 						min_dist = dist;
@@ -156,15 +158,274 @@ void 	trajectory_planning(float car_x, float car_y, float car_angle, cone *detec
 				}
 			}
 
-			temp[i] = trajectory[min_idx];
+			temp[i] = centerline[min_idx];
 			used[min_idx] = 1;
 		}
 
-		// Copy back to original array
-		for (int i = 0; i < trajectory_idx; i++) 
+		// Copy back to original array, dropping the duplicated midpoints
+		// (a pair of cones connected both ways produces the same point twice)
+		int n_unique = 0;
+		for (int i = 0; i < n_points; i++) 
+		{
+			if (n_unique > 0 &&
+				fabsf(temp[i].x - centerline[n_unique-1].x) < CENTERLINE_MERGE_DISTANCE &&
+				fabsf(temp[i].y - centerline[n_unique-1].y) < CENTERLINE_MERGE_DISTANCE)
+				continue;
+			centerline[n_unique++] = temp[i];
+		}
+		for (int i = n_unique; i < n_points; i++)
 		{
-			trajectory[i] = temp[i];
+			centerline[i].x = -1;
+			centerline[i].y = -1;
 		}
+		n_points = n_unique;
+	}
+
+	return n_points;
+}
+
+// Time left before (deadline - safety margin) on the ptask clock, in microseconds
+static long time_budget_us(timespec_custom *deadline)
+{
+	timespec_custom now;
+	ptask_gettime(&now);
+	return (deadline->tv_sec - now.tv_sec) * 1000000L + (deadline->tv_nsec - now.tv_nsec) / 1000
+			- TRAJECTORY_SAFETY_MARGIN_US;
+}
+
+static long elapsed_us(struct timespec *t0)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t0->tv_sec) * 1000000L + (now.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+static void reverse_points(waypoint *points, int n_points)
+{
+	for (int i = 0, j = n_points - 1; i < j; i++, j--) {
+		waypoint tmp = points[i];
+		points[i] = points[j];
+		points[j] = tmp;
+	}
+}
+
+// The centerline comes out in cone-chain order: reverse it if it runs
+// against the car heading (y axis pointing down) at the point nearest to the car;
+// returns 1 if reversed
+static int orient_plan(waypoint *plan, int n_points, float car_x, float car_y, float car_angle)
+{
+	if (n_points < 2) return 0;
+
+	int nearest = 0;
+	for (int i = 1; i < n_points; i++) {
+		if (hypotf(plan[i].x - car_x, plan[i].y - car_y) < hypotf(plan[nearest].x - car_x, plan[nearest].y - car_y))
+			nearest = i;
+	}
+	int from = (nearest == n_points - 1) ? nearest - 1 : nearest;
+
+	float dot = (plan[from+1].x - plan[from].x) * cosf(car_angle * deg2rad)
+				- (plan[from+1].y - plan[from].y) * sinf(car_angle * deg2rad);
+	if (dot >= 0.0f) return 0;
+
+	reverse_points(plan, n_points);
+	return 1;
+}
+
+// Moves p onto the segment between the boundary points l and r, at least
+// PLANNER_CORRIDOR_MARGIN from both (the middle if the corridor is narrower)
+static waypoint project_corridor(waypoint p, waypoint l, waypoint r)
+{
+	float dx = r.x - l.x, dy = r.y - l.y;
+	float width2 = dx * dx + dy * dy;
+	if (width2 < 1e-9f) return l;
+
+	float margin = fminf(PLANNER_CORRIDOR_MARGIN / sqrtf(width2), 0.5f);
+	float t = ((p.x - l.x) * dx + (p.y - l.y) * dy) / width2;
+	t = fminf(fmaxf(t, margin), 1.0f - margin);
+
+	return (waypoint){ l.x + t * dx, l.y + t * dy };
+}
+
+// Time from the start of the job to the end of each stage, added under stats_mutex
+static void count_stage(sim_context *ctx, int stage, struct timespec *t0)
+{
+	if (ctx->warmup) return;
+
+	long t = elapsed_us(t0);
+	pthread_mutex_lock(&stats_mutex);
+		planner_stats.stage_count[stage]++;
+		planner_stats.stage_time_us[stage] += t;
+		if (t > planner_stats.stage_max_us[stage]) planner_stats.stage_max_us[stage] = t;
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+// Copy the plan of the best stage reached to the trajectory of the context, once per job
+static void publish(sim_context *ctx, waypoint *plan, int n_points)
+{
+	for (int i = 0; i < n_points; i++) {
+		ctx->trajectory[i] = plan[i];
+	}
+	// Invalidate the tail of the previous plan (and always write the sentinel)
+	for (int i = n_points; (i == n_points || i < ctx->trajectory_idx) && i < 2*MAX_DETECTED_CONES; i++) {
+		ctx->trajectory[i].x = -1;
+		ctx->trajectory[i].y = -1;
 	}
+	ctx->trajectory_idx = n_points;
+}
+
+// Counters of the current job, added under stats_mutex
+static void count_job(sim_context *ctx, long deadline_cuts, long smooth_iterations)
+{
+	if (ctx->warmup) return;
+
+	pthread_mutex_lock(&stats_mutex);
+		planner_stats.jobs++;
+		planner_stats.deadline_cuts += deadline_cuts;
+		planner_stats.smooth_iterations += smooth_iterations;
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+// Anytime planner: a coarse path first, then refined until the deadline
+// (minus TRAJECTORY_SAFETY_MARGIN_US) of the current job. Only the best
+// stage reached is written to ctx->trajectory, at the end of the job.
+void 	trajectory_planning(sim_context *ctx, float car_x, float car_y, float car_angle, timespec_custom *deadline)
+{
+	waypoint plan[2*MAX_DETECTED_CONES];
+	struct timespec t0;
+	int n_points;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	// 1) Coarse: only the mapped cones around the car
+	cone local_map[MAX_DETECTED_CONES];
+	int n_local = 0;
+
+	for (int i = 0; i < ctx->track_map_idx && n_local < MAX_DETECTED_CONES; i++) {
+		float dx = ctx->track_map[i].x - car_x;
+		float dy = ctx->track_map[i].y - car_y;
+		if (dx * dx + dy * dy < PLANNER_COARSE_RADIUS * PLANNER_COARSE_RADIUS) {
+			local_map[n_local++] = ctx->track_map[i];
+		}
+	}
+
+	n_points = build_centerline(local_map, n_local, plan);
+	orient_plan(plan, n_points, car_x, car_y, car_angle);
+	count_stage(ctx, PLANNER_STAGE_COARSE, &t0);
+
+	if (time_budget_us(deadline) <= 0) {
+		count_job(ctx, 1, 0);
+		publish(ctx, plan, n_points);
+		return;
+	}
+
+	// 2) Full: whole map, from the boundary polylines when both are available
+	waypoint left[2*MAX_DETECTED_CONES], right[2*MAX_DETECTED_CONES];	// corridor at each point
+	int corridor = 1;
+	boundaries_get(&ctx->boundaries);	// copied only when the version changes
+
+	n_points = boundaries_centerline(&ctx->boundaries, plan, left, right, 2*MAX_DETECTED_CONES - 1);
+	if (n_points < 2) {
+		n_points = build_centerline(ctx->track_map, ctx->track_map_idx, plan);
+		corridor = 0;
+	}
+	if (orient_plan(plan, n_points, car_x, car_y, car_angle) && corridor) {
+		reverse_points(left, n_points);
+		reverse_points(right, n_points);
+	}
+	count_stage(ctx, PLANNER_STAGE_FULL, &t0);
+
+	// 3) Smooth: Laplacian smoothing passes kept inside the corridor, until the
+	// points stop moving or the time is up (no corridor without both boundaries)
+	int iterations = 0, cut = 0;
+
+	while (corridor && n_points > 2 && iterations < PLANNER_MAX_SMOOTH_ITERS)
+	{
+		if (time_budget_us(deadline) <= 0) {
+			cut = 1;
+			break;
+		}
+
+		float moved = 0.0f;
+		waypoint prev = plan[0];
+		for (int i = 1; i < n_points - 1; i++) {
+			waypoint current = plan[i];
+			waypoint smoothed = {
+				plan[i].x + PLANNER_SMOOTH_WEIGHT * (0.5f * (prev.x + plan[i+1].x) - plan[i].x),
+				plan[i].y + PLANNER_SMOOTH_WEIGHT * (0.5f * (prev.y + plan[i+1].y) - plan[i].y)
+			};
+			plan[i] = project_corridor(smoothed, left[i], right[i]);
+			moved = fmaxf(moved, hypotf(plan[i].x - current.x, plan[i].y - current.y));
+			prev = current;
+		}
+		iterations++;
+		if (moved < PLANNER_SMOOTH_TOL) break;
+	}
+	count_job(ctx, cut, iterations);
+
+	if (iterations > 0) {
+		count_stage(ctx, PLANNER_STAGE_SMOOTH, &t0);
+	}
+	publish(ctx, plan, n_points);
 	// printf("Trajectory points: %d\n", trajectory_idx);
 }
+
+void 	trajectory_get_stats(planner_stats_t *stats)
+{
+	pthread_mutex_lock(&stats_mutex);
+		*stats = planner_stats;
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+void 	trajectory_print_stats()
+{
+	const char *stage_names[PLANNER_N_STAGES] = {"COARSE", "FULL", "SMOOTH"};
+	planner_stats_t stats;
+
+	trajectory_get_stats(&stats);
+	printf("Trajectory planner: %ld jobs, %ld cut by the deadline, %ld smoothing iterations\n",
+		stats.jobs, stats.deadline_cuts, stats.smooth_iterations);
+
+	for (int stage = 0; stage < PLANNER_N_STAGES; stage++) {
+		long count = stats.stage_count[stage];
+		printf("  %-7s reached %6ld times, mean %6ld us, max %6ld us\n",
+			stage_names[stage], count,
+			count > 0 ? stats.stage_time_us[stage] / count : 0,
+			stats.stage_max_us[stage]);
+	}
+}
+
+void	trajectory_publish_snapshot(waypoint *trajectory, int n_points, float *speed)
+{
+	if (n_points > 2*MAX_DETECTED_CONES) n_points = 2*MAX_DETECTED_CONES;
+
+	pthread_mutex_lock(&snapshot_mutex);
+		for (int i = 0; i < n_points; i++) {
+			snapshot.points[i] = trajectory[i];
+			snapshot.speed[i] = speed[i];
+		}
+		snapshot.n_points = n_points;
+		snapshot.version++;
+	pthread_mutex_unlock(&snapshot_mutex);
+}
+
+int		trajectory_get_snapshot(trajectory_snapshot_t *out)
+{
+	int updated = 0;
+
+	// Busy writer: keep following the previous snapshot
+	if (pthread_mutex_trylock(&snapshot_mutex) != 0) return 0;
+
+		if (out->version != snapshot.version)
+		{
+			for (int i = 0; i < snapshot.n_points; i++) {
+				out->points[i] = snapshot.points[i];
+				out->speed[i] = snapshot.speed[i];
+			}
+			out->n_points = snapshot.n_points;
+			out->version = snapshot.version;
+			updated = 1;
+		}
+	pthread_mutex_unlock(&snapshot_mutex);
+
+	return updated;
+}
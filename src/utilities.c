@@ -150,29 +150,3 @@ float angle_rotation_sprite(float angle)
     return 64.0f - 128.0f * angle / 180.0f;
 }
 
-
-// Helper functions to measure code performance
-void runtime (int stop_signal, char* task_name)
-{
-#ifdef PROFILING
-
-	static struct timespec iter_start, iter_end;
-	if (stop_signal == 0){
-		clock_gettime(CLOCK_MONOTONIC, &iter_start);
-		unsigned long iter_start_time_us = (iter_start.tv_sec) * 1000000UL +
-										(iter_start.tv_nsec) / 1000;
-		printf("[%s],START,%lu\n", task_name, iter_start_time_us);
-	}
-	else{
-		clock_gettime(CLOCK_MONOTONIC, &iter_end);
-		unsigned long iter_runtime_us = (iter_end.tv_sec - iter_start.tv_sec) * 1000000UL +
-										(iter_end.tv_nsec - iter_start.tv_nsec) / 1000;
-
-		unsigned long iter_end_time_us = (iter_end.tv_sec) * 1000000UL +
-										(iter_end.tv_nsec) / 1000;
-		printf("[%s],END,%lu\n", task_name, iter_end_time_us);
-		// printf("[%s]\t Runtime: %lu us\n", task_name, iter_runtime_us);
-	}
-
-#endif /* PROFILING */
-}
\ No newline at end of file
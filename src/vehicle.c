@@ -2,49 +2,148 @@
 #include <stdio.h>
 #include "vehicle.h"
 #include "globals.h"
+#include "sim_context.h"
 
-void 	vehicle_model(float *car_x, float *car_y, int *car_angle, float pedal, float steering)
-{
-// Simulation parameters
-const float     dt = 0.1;			// time step
+/*
+	Dynamic single-track (bicycle) model.
+
+	Body-frame velocities vx, vy and yaw rate r, lateral tire forces from a
+	simplified Pacejka curve on the front and rear slip angles:
+
+		vx' = (Fx - Fyf sin(delta)) / m + vy r
+		vy' = (Fyr + Fyf cos(delta)) / m - vx r
+		r'  = (lf Fyf cos(delta) - lr Fyr) / Iz
+
+	Slip angles are not defined at standstill: below VEHICLE_BLEND_LOW the state
+	is projected on the kinematic model (r = vx tan(delta) / L, vy = lr r), and
+	the projection fades out up to VEHICLE_BLEND_HIGH.
+	Integration uses fixed RK4 steps of 1 / VEHICLE_RK4_RATE simulated seconds.
+*/
 
-const float		mass = 100;      	// mass of the vehicle [kg]
-const float     wheelbase = 2.0;	// distance between front and rear axles [m]
-const float		maxSpeed = 1.0;		// maximum speed in m/s
-const float     maxBraking = 50.0;	// maximum braking in m/s^2
 
-float theta;
+static void derivatives(const vehicle_state *s, float pedal, float steering, vehicle_state *d)
+{
+	// Longitudinal force: towards pedal * VEHICLE_MAX_SPEED, or braking proportional to speed
+	float fx = (pedal > 0.0f) ? VEHICLE_DRIVE_GAIN * (pedal * VEHICLE_MAX_SPEED - s->vx)
+							: pedal * VEHICLE_MAX_BRAKING * s->vx;
+
+	float cos_yaw = cosf(s->yaw), sin_yaw = sinf(s->yaw);
 
-static float current_speed = 0.0; 	// persist speed between calls
-float speed, acceleration;
+	d->x = s->vx * cos_yaw - s->vy * sin_yaw;
+	d->y = -(s->vx * sin_yaw + s->vy * cos_yaw);
+	d->yaw = s->r;
 
-	if (pedal > 0.0)
+	if (s->vx < VEHICLE_BLEND_LOW)
 	{
-		speed = pedal * maxSpeed;	// speed in m/s
-		acceleration = (speed - current_speed) / mass;  // F = ma -> a = F/m
-	}
-	else
-	{	// Brake
-		acceleration = (pedal * maxBraking * current_speed) / mass;  // F = ma
+		// kinematic: vy and r follow from the projection
+		d->vx = fx / VEHICLE_MASS;
+		d->vy = 0.0f;
+		d->r = 0.0f;
+		return;
 	}
 
-	current_speed += acceleration * dt;
-	
-	speed = (current_speed < 0.0) ? 0.0 : current_speed;  // use the actual speed with inertia
+	float alpha_f = steering - atan2f(s->vy + VEHICLE_LF * s->r, s->vx);
+	float alpha_r = -atan2f(s->vy - VEHICLE_LR * s->r, s->vx);
+
+	float fz_f = VEHICLE_MASS * GRAVITY * VEHICLE_LR / VEHICLE_WHEELBASE;
+	float fz_r = VEHICLE_MASS * GRAVITY * VEHICLE_LF / VEHICLE_WHEELBASE;
+	float fy_f = TIRE_MU * fz_f * sinf(TIRE_C * atanf(TIRE_B * alpha_f));
+	float fy_r = TIRE_MU * fz_r * sinf(TIRE_C * atanf(TIRE_B * alpha_r));
+
+	float cos_steer = cosf(steering), sin_steer = sinf(steering);
+
+	d->vx = (fx - fy_f * sin_steer) / VEHICLE_MASS + s->vy * s->r;
+	d->vy = (fy_r + fy_f * cos_steer) / VEHICLE_MASS - s->vx * s->r;
+	d->r = (VEHICLE_LF * fy_f * cos_steer - VEHICLE_LR * fy_r) / VEHICLE_IZ;
+}
+
+// out = s + h * d
+static void add_scaled(vehicle_state *out, const vehicle_state *s, const vehicle_state *d, float h)
+{
+	out->x = s->x + h * d->x;
+	out->y = s->y + h * d->y;
+	out->yaw = s->yaw + h * d->yaw;
+	out->vx = s->vx + h * d->vx;
+	out->vy = s->vy + h * d->vy;
+	out->r = s->r + h * d->r;
+}
+
+void	vehicle_step(vehicle_state *state, float pedal, float steering, float dt)
+{
+	if (steering > VEHICLE_MAX_STEERING) steering = VEHICLE_MAX_STEERING;
+	if (steering < -VEHICLE_MAX_STEERING) steering = -VEHICLE_MAX_STEERING;
 
-	// Update vehicle position using a simple bicycle model (Ackermann steering)
-	theta = (*car_angle) * deg2rad;              // convert current heading to radians
-	*car_x += speed * cos(-theta) * dt;                   // update x position
-	*car_y += speed * sin(-theta) * dt;                   // update y position
+	int n_steps = (int)ceilf(dt * VEHICLE_RK4_RATE - 1e-3f);
+	if (n_steps < 1) n_steps = 1;
+	float h = dt / n_steps;
+	float tan_steer = tanf(steering);
 
-	if (speed < 0.01 * maxSpeed)
+	for (int i = 0; i < n_steps; i++)
 	{
-		// If the car is stopped, the steering angle is irrelevant
-		return;
+		vehicle_state k1, k2, k3, k4, tmp;
+
+		derivatives(state, pedal, steering, &k1);
+		add_scaled(&tmp, state, &k1, 0.5f * h);
+		derivatives(&tmp, pedal, steering, &k2);
+		add_scaled(&tmp, state, &k2, 0.5f * h);
+		derivatives(&tmp, pedal, steering, &k3);
+		add_scaled(&tmp, state, &k3, h);
+		derivatives(&tmp, pedal, steering, &k4);
+
+		state->x += h / 6.0f * (k1.x + 2.0f * k2.x + 2.0f * k3.x + k4.x);
+		state->y += h / 6.0f * (k1.y + 2.0f * k2.y + 2.0f * k3.y + k4.y);
+		state->yaw += h / 6.0f * (k1.yaw + 2.0f * k2.yaw + 2.0f * k3.yaw + k4.yaw);
+		state->vx += h / 6.0f * (k1.vx + 2.0f * k2.vx + 2.0f * k3.vx + k4.vx);
+		state->vy += h / 6.0f * (k1.vy + 2.0f * k2.vy + 2.0f * k3.vy + k4.vy);
+		state->r += h / 6.0f * (k1.r + 2.0f * k2.r + 2.0f * k3.r + k4.r);
+
+		if (state->vx < 0.0f) state->vx = 0.0f; // brakes do not reverse
+
+		// Kinematic projection at low speed
+		float w = (state->vx - VEHICLE_BLEND_LOW) / (VEHICLE_BLEND_HIGH - VEHICLE_BLEND_LOW);
+		if (w < 1.0f)
+		{
+			if (w < 0.0f) w = 0.0f;
+			float r_kin = state->vx * tan_steer / VEHICLE_WHEELBASE;
+			state->r = w * state->r + (1.0f - w) * r_kin;
+			state->vy = w * state->vy + (1.0f - w) * VEHICLE_LR * r_kin;
+		}
 	}
-	theta += (1.0 / wheelbase) * tan(steering) * dt;   // update heading independent of speed
+}
 
-	// Store updated heading in degrees
-	*car_angle = (int)(theta / deg2rad);
+void 	vehicle_model(sim_context *ctx, float *car_x, float *car_y, int *car_angle, float pedal, float steering)
+{
+	vehicle_state *vehicle = &ctx->vehicle;
 
-}
\ No newline at end of file
+	// car_x, car_y, car_angle are compared with their last written value to detect changes made from outside
+	if (!ctx->vehicle_synced || *car_x != ctx->last_x || *car_y != ctx->last_y) {
+		vehicle->x = *car_x;
+		vehicle->y = *car_y;
+	}
+	if (!ctx->vehicle_synced || *car_angle != ctx->last_angle) {
+		vehicle->yaw = *car_angle * deg2rad;
+	}
+	ctx->vehicle_synced = 1;
+
+	vehicle_step(vehicle, pedal, steering, VEHICLE_DT);
+
+	// Mirror the state in the display variables (heading in whole degrees)
+	*car_x = vehicle->x;
+	*car_y = vehicle->y;
+	*car_angle = (int)lroundf(vehicle->yaw / deg2rad);
+
+	ctx->last_x = *car_x;
+	ctx->last_y = *car_y;
+	ctx->last_angle = *car_angle;
+}
+
+float	vehicle_speed(const sim_context *ctx)
+{
+	return ctx->vehicle.vx;
+}
+
+float	vehicle_yaw(const sim_context *ctx, int car_angle)
+{
+	if (!ctx->vehicle_synced || car_angle != ctx->last_angle) return car_angle * deg2rad;
+	return ctx->vehicle.yaw;
+}
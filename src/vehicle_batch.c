@@ -0,0 +1,239 @@
+#include <math.h>
+#include <string.h>
+#include "vehicle_batch.h"
+
+/*
+	Batch version of vehicle_step(): the same RK4 integration of the dynamic
+	bicycle model, written with GCC vector extensions so that every operation
+	works on VEHICLE_BATCH_LANES cars at once.
+
+	Branches of the scalar model (throttle/brake, kinematic/dynamic, low-speed
+	projection) become per-lane selects. libm has no vector atanf/sinf/cosf,
+	so the tire and heading terms use the Cephes single-precision polynomials
+	(about 1e-7 relative error), which keeps the batch within
+	VEHICLE_BATCH_TOLERANCE of vehicle_step().
+*/
+
+typedef float	vf __attribute__((vector_size(4 * VEHICLE_BATCH_LANES)));
+typedef int		vi __attribute__((vector_size(4 * VEHICLE_BATCH_LANES)));
+typedef unsigned	vu __attribute__((vector_size(4 * VEHICLE_BATCH_LANES)));	// shifts into the sign bit
+
+typedef struct {
+	vf	x, y, yaw, vx, vy, r;
+} lanes;
+
+#define SIGN_BIT	((int)0x80000000)
+#define PI_2		1.57079632679489661923f
+#define PI_4		0.78539816339744830962f
+
+// ---------------- Vector helpers ----------------
+
+// mask ? a : b, mask lanes being all ones or all zeros
+static inline vf vselect(vi mask, vf a, vf b)
+{
+	return (vf)(((vi)a & mask) | ((vi)b & ~mask));
+}
+
+static inline vf vabs(vf a)
+{
+	return (vf)((vi)a & ~SIGN_BIT);
+}
+
+static inline vf vmax(vf a, vf b)
+{
+	return vselect(a > b, a, b);
+}
+
+static inline vf vmin(vf a, vf b)
+{
+	return vselect(a < b, a, b);
+}
+
+static inline vf vatan(vf x)
+{
+	vi sign = (vi)x & SIGN_BIT;
+	vf a = vabs(x);
+
+	// Reduce to |x| <= tan(pi/8)
+	vi big = a > 2.414213562373095f;
+	vi mid = (a > 0.4142135623730950f) & ~big;
+	vf offset = vselect(big, (vf){} + PI_2, vselect(mid, (vf){} + PI_4, (vf){}));
+	a = vselect(big, -1.0f / vmax(a, (vf){} + 1.0f), vselect(mid, (a - 1.0f) / (a + 1.0f), a));
+
+	vf z = a * a;
+	vf y = offset + ((((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * a + a);
+
+	return (vf)((vi)y ^ sign);
+}
+
+static inline void vsincos(vf x, vf *s, vf *c)
+{
+	vi sign = (vi)x & SIGN_BIT;
+	vf a = vabs(x);
+
+	// Octant j (even), a - j pi/4 in three parts for the precision
+	vi j = __builtin_convertvector(a * 1.27323954473516f, vi);
+	j = (j + 1) & ~1;
+	vf fj = __builtin_convertvector(j, vf);
+	a = ((a - fj * 0.78515625f) - fj * 2.4187564849853515625e-4f) - fj * 3.77489497744594108e-8f;
+
+	vf z = a * a;
+	vf ps = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * a + a;
+	vf pc = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;
+
+	vi swap = (j & 2) != 0;
+	*s = (vf)((vi)vselect(swap, pc, ps) ^ sign ^ (vi)((vu)(j & 4) << 29));
+	*c = (vf)((vi)vselect(swap, ps, pc) ^ (vi)((vu)((j + 2) & 4) << 29));
+}
+
+// ---------------- Model ----------------
+
+// derivatives() of vehicle.c, one car per lane
+static inline void derivatives(const lanes *s, vf pedal, vf steering, vf cos_steer, vf sin_steer, lanes *d)
+{
+	vf fx = vselect(pedal > 0.0f, VEHICLE_DRIVE_GAIN * (pedal * VEHICLE_MAX_SPEED - s->vx),
+								pedal * VEHICLE_MAX_BRAKING * s->vx);
+
+	vf cos_yaw, sin_yaw;
+	vsincos(s->yaw, &sin_yaw, &cos_yaw);
+
+	d->x = s->vx * cos_yaw - s->vy * sin_yaw;
+	d->y = -(s->vx * sin_yaw + s->vy * cos_yaw);
+	d->yaw = s->r;
+
+	// vx > 0 in the dynamic lanes: atan2(y, vx) = atan(y / vx)
+	vf vx = vmax(s->vx, (vf){} + VEHICLE_BLEND_LOW);
+	vf alpha_f = steering - vatan((s->vy + VEHICLE_LF * s->r) / vx);
+	vf alpha_r = -vatan((s->vy - VEHICLE_LR * s->r) / vx);
+
+	const float fz_f = VEHICLE_MASS * GRAVITY * VEHICLE_LR / VEHICLE_WHEELBASE;
+	const float fz_r = VEHICLE_MASS * GRAVITY * VEHICLE_LF / VEHICLE_WHEELBASE;
+	vf sin_f, sin_r, unused;
+	vsincos(TIRE_C * vatan(TIRE_B * alpha_f), &sin_f, &unused);
+	vsincos(TIRE_C * vatan(TIRE_B * alpha_r), &sin_r, &unused);
+	vf fy_f = TIRE_MU * fz_f * sin_f;
+	vf fy_r = TIRE_MU * fz_r * sin_r;
+
+	// Kinematic lanes: vy and r follow from the projection
+	vi kinematic = s->vx < VEHICLE_BLEND_LOW;
+
+	d->vx = vselect(kinematic, fx / VEHICLE_MASS, (fx - fy_f * sin_steer) / VEHICLE_MASS + s->vy * s->r);
+	d->vy = vselect(kinematic, (vf){}, (fy_r + fy_f * cos_steer) / VEHICLE_MASS - s->vx * s->r);
+	d->r = vselect(kinematic, (vf){}, (VEHICLE_LF * fy_f * cos_steer - VEHICLE_LR * fy_r) / VEHICLE_IZ);
+}
+
+static inline void add_scaled(lanes *out, const lanes *s, const lanes *d, float h)
+{
+	out->x = s->x + h * d->x;
+	out->y = s->y + h * d->y;
+	out->yaw = s->yaw + h * d->yaw;
+	out->vx = s->vx + h * d->vx;
+	out->vy = s->vy + h * d->vy;
+	out->r = s->r + h * d->r;
+}
+
+static void step_lanes(lanes *s, vf pedal, vf steering, int n_steps, float h)
+{
+	steering = vmin(vmax(steering, (vf){} - VEHICLE_MAX_STEERING), (vf){} + VEHICLE_MAX_STEERING);
+
+	vf cos_steer, sin_steer;
+	vsincos(steering, &sin_steer, &cos_steer);
+	vf tan_steer = sin_steer / cos_steer;
+
+	for (int i = 0; i < n_steps; i++)
+	{
+		lanes k1, k2, k3, k4, tmp;
+
+		derivatives(s, pedal, steering, cos_steer, sin_steer, &k1);
+		add_scaled(&tmp, s, &k1, 0.5f * h);
+		derivatives(&tmp, pedal, steering, cos_steer, sin_steer, &k2);
+		add_scaled(&tmp, s, &k2, 0.5f * h);
+		derivatives(&tmp, pedal, steering, cos_steer, sin_steer, &k3);
+		add_scaled(&tmp, s, &k3, h);
+		derivatives(&tmp, pedal, steering, cos_steer, sin_steer, &k4);
+
+		s->x += h / 6.0f * (k1.x + 2.0f * k2.x + 2.0f * k3.x + k4.x);
+		s->y += h / 6.0f * (k1.y + 2.0f * k2.y + 2.0f * k3.y + k4.y);
+		s->yaw += h / 6.0f * (k1.yaw + 2.0f * k2.yaw + 2.0f * k3.yaw + k4.yaw);
+		s->vx += h / 6.0f * (k1.vx + 2.0f * k2.vx + 2.0f * k3.vx + k4.vx);
+		s->vy += h / 6.0f * (k1.vy + 2.0f * k2.vy + 2.0f * k3.vy + k4.vy);
+		s->r += h / 6.0f * (k1.r + 2.0f * k2.r + 2.0f * k3.r + k4.r);
+
+		s->vx = vmax(s->vx, (vf){}); // brakes do not reverse
+
+		// Kinematic projection at low speed (w = 1 leaves the lane unchanged)
+		vf w = (s->vx - VEHICLE_BLEND_LOW) / (VEHICLE_BLEND_HIGH - VEHICLE_BLEND_LOW);
+		w = vmin(vmax(w, (vf){}), (vf){} + 1.0f);
+		vf r_kin = s->vx * tan_steer / VEHICLE_WHEELBASE;
+		s->r = w * s->r + (1.0f - w) * r_kin;
+		s->vy = w * s->vy + (1.0f - w) * VEHICLE_LR * r_kin;
+	}
+}
+
+// ---------------- Batch ----------------
+
+void	vehicle_batch_init(vehicle_batch *batch, int n, const vehicle_state *state)
+{
+	if (n > VEHICLE_BATCH_MAX) n = VEHICLE_BATCH_MAX;
+	if (n < 0) n = 0;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->n = n;
+	for (int i = 0; i < n; i++)
+		vehicle_batch_set(batch, i, state);
+}
+
+void	vehicle_batch_set(vehicle_batch *batch, int i, const vehicle_state *state)
+{
+	batch->x[i] = state->x;
+	batch->y[i] = state->y;
+	batch->yaw[i] = state->yaw;
+	batch->vx[i] = state->vx;
+	batch->vy[i] = state->vy;
+	batch->r[i] = state->r;
+}
+
+void	vehicle_batch_get(const vehicle_batch *batch, int i, vehicle_state *state)
+{
+	state->x = batch->x[i];
+	state->y = batch->y[i];
+	state->yaw = batch->yaw[i];
+	state->vx = batch->vx[i];
+	state->vy = batch->vy[i];
+	state->r = batch->r[i];
+}
+
+void	vehicle_batch_step(vehicle_batch *batch, const float *pedal, const float *steering, float dt)
+{
+	int n_steps = (int)ceilf(dt * VEHICLE_RK4_RATE - 1e-3f);
+	if (n_steps < 1) n_steps = 1;
+	float h = dt / n_steps;
+
+	for (int i = 0; i < batch->n; i += VEHICLE_BATCH_LANES)
+	{
+		// Inputs are not padded: the last group reads only the cars in use
+		int count = batch->n - i;
+		if (count > VEHICLE_BATCH_LANES) count = VEHICLE_BATCH_LANES;
+
+		vf p = {}, st = {};
+		memcpy(&p, pedal + i, count * sizeof(float));
+		memcpy(&st, steering + i, count * sizeof(float));
+
+		lanes s;
+		s.x = *(vf *)&batch->x[i];
+		s.y = *(vf *)&batch->y[i];
+		s.yaw = *(vf *)&batch->yaw[i];
+		s.vx = *(vf *)&batch->vx[i];
+		s.vy = *(vf *)&batch->vy[i];
+		s.r = *(vf *)&batch->r[i];
+
+		step_lanes(&s, p, st, n_steps, h);
+
+		*(vf *)&batch->x[i] = s.x;
+		*(vf *)&batch->y[i] = s.y;
+		*(vf *)&batch->yaw[i] = s.yaw;
+		*(vf *)&batch->vx[i] = s.vx;
+		*(vf *)&batch->vy[i] = s.vy;
+		*(vf *)&batch->r[i] = s.r;
+	}
+}
@@ -0,0 +1,99 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "globals.h"
+#include "trajectory.h"
+#include "velocity.h"
+#include "vehicle.h"
+#include "sim_context.h"
+
+// Menger curvature of the circle through three points
+static float curvature(waypoint a, waypoint b, waypoint c)
+{
+	float ab = hypotf(b.x - a.x, b.y - a.y);
+	float bc = hypotf(c.x - b.x, c.y - b.y);
+	float ca = hypotf(a.x - c.x, a.y - c.y);
+	float cross = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+
+	if (ab * bc * ca < 1e-9f) return 0.0f;
+	return 2.0f * fabsf(cross) / (ab * bc * ca);
+}
+
+static float segment_length(waypoint *path, int i)
+{
+	return hypotf(path[i].x - path[i-1].x, path[i].y - path[i-1].y);
+}
+
+int velocity_profile(sim_context *ctx, float start_speed)
+{
+	velocity_profile_t *profile = &ctx->velocity;
+	waypoint *trajectory = ctx->trajectory;
+	int n_points = ctx->trajectory_idx;
+
+	if (n_points <= 0) {
+		profile->n_points = 0;
+		return 0;
+	}
+
+	// First point that differs from the last profiled path (all of them if the car changed speed)
+	int first_changed = 0;
+	if (fabsf(start_speed - profile->start_speed) >= PROFILE_SPEED_EPSILON)
+		profile->n_points = 0;
+
+	while (first_changed < n_points && first_changed < profile->n_points &&
+			fabsf(trajectory[first_changed].x - profile->path[first_changed].x) < PROFILE_EPSILON &&
+			fabsf(trajectory[first_changed].y - profile->path[first_changed].y) < PROFILE_EPSILON)
+		first_changed++;
+
+	if (first_changed == n_points && n_points == profile->n_points)
+		return 0; // same path, same profile
+
+	for (int i = first_changed; i < n_points; i++)
+		profile->path[i] = trajectory[i];
+	profile->n_points = n_points;
+
+	// 1) Curvature limit: v^2 * k <= a_lat (a point depends on its two neighbours)
+	int start = (first_changed > 0) ? first_changed - 1 : 0;
+
+	for (int i = start; i < n_points; i++)
+	{
+		float k = (i > 0 && i < n_points - 1) ? curvature(trajectory[i-1], trajectory[i], trajectory[i+1]) : 0.0f;
+		profile->limit[i] = (k > 1e-6f) ? sqrtf(MAX_LATERAL_ACCEL / k) : VEHICLE_MAX_SPEED;
+		if (profile->limit[i] > VEHICLE_MAX_SPEED) profile->limit[i] = VEHICLE_MAX_SPEED;
+	}
+
+	// 2) Forward pass: v_i^2 <= v_(i-1)^2 + 2 a_acc ds, from the measured speed
+	for (int i = start; i < n_points; i++)
+	{
+		if (i == 0) {
+			profile->start_speed = start_speed;
+			profile->forward[0] = fminf(profile->limit[0], fmaxf(start_speed, 0.0f));
+			continue;
+		}
+		float v_reach = sqrtf(profile->forward[i-1] * profile->forward[i-1] + 2.0f * MAX_LONG_ACCEL * segment_length(trajectory, i));
+		profile->forward[i] = fminf(profile->limit[i], v_reach);
+	}
+
+	// 3) Backward pass: v_i^2 <= v_(i+1)^2 + 2 a_dec ds
+	// Before the changed section the forward speeds are unchanged, so the pass
+	// stops as soon as it reproduces the previous value.
+	int recomputed = n_points - start;
+	int closed = (n_points > 2 && hypotf(trajectory[n_points-1].x - trajectory[0].x,
+								trajectory[n_points-1].y - trajectory[0].y) < PROFILE_LOOP_DISTANCE);
+	profile->speed[n_points-1] = closed ? profile->forward[n_points-1] : 0.0f;
+
+	for (int i = n_points - 2; i >= 0; i--)
+	{
+		float v_reach = sqrtf(profile->speed[i+1] * profile->speed[i+1] + 2.0f * MAX_LONG_DECEL * segment_length(trajectory, i+1));
+		float v = fminf(profile->forward[i], v_reach);
+
+		if (i < start)
+		{
+			if (v == profile->speed[i]) break;
+			recomputed++;
+		}
+		profile->speed[i] = v;
+	}
+
+	return recomputed;
+}
@@ -0,0 +1,384 @@
+/*
+	Batch runner: runs the headless simulator once per combination of the
+	parameters of a sweep file, in parallel (one process per run, so every
+	run has its own copy of the simulator globals), then collects the output
+	of every run in one CSV row.
+
+	Usage: ./tools/batch_runner [-j jobs] [-l laps] [-s seconds] [-b simulator]
+	                            [-d workdir] [-o results.csv] sweep.txt
+
+	Sweep file, one parameter per line, the runs being all the combinations:
+
+		# name value...
+		controller	mpc pursuit
+		track		track/cones.yaml@2.85,3.60,104	(track file[@start pose])
+		detections_threshold	5 10 20			(any 2D_sim --set parameter)
+
+	Run k writes workdir/run_k.csv (headless output) and workdir/run_k.log
+	(stderr of the simulator).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_DIMS		32
+#define MAX_VALUES		64
+#define MAX_RUNS		100000
+#define MAX_METRICS		64
+#define MAX_ARGS		(1 + 4 * MAX_DIMS + 8)	// simulator, up to 4 per dimension (track with a start pose), 7 fixed, NULL
+#define NAME_LENGTH		64
+#define VALUE_LENGTH	256		// longest value of a parameter
+
+typedef struct {
+	char	name[NAME_LENGTH];
+	int		n_values;
+	char	*values[MAX_VALUES];
+} dimension_t;
+
+typedef struct {
+	pid_t	pid;
+	int		status;				// exit status of the simulator, -1 if it did not exit
+} run_t;
+
+static dimension_t	dims[MAX_DIMS];
+static int			n_dims = 0;
+
+static char			metric_names[MAX_METRICS][2 * NAME_LENGTH];	// columns after the lap times
+static int			n_metrics = 0;
+
+static const char	*simulator = "./2D_sim";
+static const char	*workdir = "batch";
+static int			laps = 3;
+static const char	*seconds = "0";
+
+
+static int read_sweep(const char *path)
+{
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	char line[4096];
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		char *comment = strchr(line, '#');
+		if (comment != NULL) *comment = '\0';
+
+		char *token = strtok(line, " \t\r\n");
+		if (token == NULL) continue;
+
+		if (n_dims == MAX_DIMS) {
+			fprintf(stderr, "%s: more than %d parameters\n", path, MAX_DIMS);
+			fclose(in);
+			return 0;
+		}
+
+		dimension_t *d = &dims[n_dims++];
+		if (strlen(token) >= sizeof(d->name)) {
+			fprintf(stderr, "%s: parameter name longer than %d characters: %s\n", path, NAME_LENGTH - 1, token);
+			fclose(in);
+			return 0;
+		}
+		strcpy(d->name, token);
+		d->n_values = 0;
+
+		while ((token = strtok(NULL, " \t\r\n")) != NULL)
+		{
+			if (d->n_values == MAX_VALUES) {
+				fprintf(stderr, "%s: more than %d values for %s\n", path, MAX_VALUES, d->name);
+				fclose(in);
+				return 0;
+			}
+			if (strlen(token) > VALUE_LENGTH) {
+				fprintf(stderr, "%s: value of %s longer than %d characters\n", path, d->name, VALUE_LENGTH);
+				fclose(in);
+				return 0;
+			}
+			d->values[d->n_values++] = strdup(token);
+		}
+
+		if (d->n_values == 0) {
+			fprintf(stderr, "%s: no values for %s\n", path, d->name);
+			fclose(in);
+			return 0;
+		}
+	}
+	fclose(in);
+	return 1;
+}
+
+// Value of every dimension for run k (mixed radix digits of k)
+static void run_values(int k, const char **values)
+{
+	for (int i = n_dims - 1; i >= 0; i--)
+	{
+		values[i] = dims[i].values[k % dims[i].n_values];
+		k /= dims[i].n_values;
+	}
+}
+
+static void run_path(int k, const char *extension, char *path, size_t size)
+{
+	snprintf(path, size, "%s/run_%d.%s", workdir, k, extension);
+}
+
+static pid_t start_run(int k)
+{
+	const char *values[MAX_DIMS];
+	run_values(k, values);
+
+	char output[1024], log[1024], laps_arg[32];
+	char sets[MAX_DIMS][NAME_LENGTH + 1 + VALUE_LENGTH + 1];	// name=value
+	char track[VALUE_LENGTH + 1];
+	run_path(k, "csv", output, sizeof(output));
+	run_path(k, "log", log, sizeof(log));
+	snprintf(laps_arg, sizeof(laps_arg), "%d", laps);
+
+	const char *argv[MAX_ARGS];
+	int argc = 0;
+	argv[argc++] = simulator;
+
+	for (int i = 0; i < n_dims; i++)
+	{
+		if (strcmp(dims[i].name, "controller") == 0)
+			argv[argc++] = values[i];
+		else if (strcmp(dims[i].name, "track") == 0)
+		{
+			// file[@x,y,deg]
+			if (snprintf(track, sizeof(track), "%s", values[i]) >= (int)sizeof(track)) {
+				fprintf(stderr, "run %d: track %s is too long\n", k, values[i]);
+				return -1;
+			}
+			char *start = strchr(track, '@');
+			if (start != NULL) *start++ = '\0';
+
+			argv[argc++] = "--track";
+			argv[argc++] = track;
+			if (start != NULL) {
+				argv[argc++] = "--start";
+				argv[argc++] = start;
+			}
+		}
+		else
+		{
+			// Checked by read_sweep(), but never run with a cut value
+			if (snprintf(sets[i], sizeof(sets[i]), "%s=%s", dims[i].name, values[i]) >= (int)sizeof(sets[i])) {
+				fprintf(stderr, "run %d: %s=%s is too long\n", k, dims[i].name, values[i]);
+				return -1;
+			}
+			argv[argc++] = "--set";
+			argv[argc++] = sets[i];
+		}
+	}
+	argv[argc++] = "--headless";
+	argv[argc++] = "--laps";
+	argv[argc++] = laps_arg;
+	argv[argc++] = "--seconds";
+	argv[argc++] = seconds;
+	argv[argc++] = "--output";
+	argv[argc++] = output;
+	argv[argc] = NULL;
+
+	pid_t pid = fork();
+	if (pid < 0) perror("fork");
+	if (pid != 0) return pid; // parent, or -1
+
+	// Child: profiler rows on stdout are not needed, stderr goes to the log
+	int null_fd = open("/dev/null", O_WRONLY);
+	int log_fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+	if (log_fd >= 0) dup2(log_fd, STDERR_FILENO);
+
+	execv(simulator, (char **)argv);
+	fprintf(stderr, "%s: %s\n", simulator, strerror(errno));
+	_exit(127);
+}
+
+// ---------------- Results ----------------
+
+static int metric_index(const char *name)
+{
+	for (int i = 0; i < n_metrics; i++)
+		if (strcmp(metric_names[i], name) == 0) return i;
+
+	if (n_metrics == MAX_METRICS) return -1;
+	snprintf(metric_names[n_metrics], sizeof(metric_names[0]), "%s", name);
+	return n_metrics++;
+}
+
+typedef struct {
+	int		laps;
+	double	first_lap, best_lap, total_lap;
+	int		has_metric[MAX_METRICS];
+	char	metric[MAX_METRICS][32];
+} result_t;
+
+// Reads the [TAG],KEY,value rows of a headless output; returns 0 if missing
+static int read_result(int k, result_t *r)
+{
+	char path[1024];
+	run_path(k, "csv", path, sizeof(path));
+
+	memset(r, 0, sizeof(*r));
+	FILE *in = fopen(path, "r");
+	if (in == NULL) return 0;
+
+	char line[256], tag[NAME_LENGTH], key[NAME_LENGTH], value[32];
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		if (sscanf(line, "[%63[^]]],%63[^,],%31s", tag, key, value) != 3) continue;
+
+		if (strcmp(tag, "LAP") == 0)
+		{
+			double lap = atof(value);
+			if (r->laps == 0) r->first_lap = lap;
+			if (r->laps == 0 || lap < r->best_lap) r->best_lap = lap;
+			r->total_lap += lap;
+			r->laps++;
+			continue;
+		}
+
+		// Column name: tag_key in lower case, e.g. perception_cpu_mean_us
+		char name[2 * NAME_LENGTH];
+		snprintf(name, sizeof(name), "%s_%s", tag, key);
+		for (char *c = name; *c; c++) *c = tolower((unsigned char)*c);
+
+		int m = metric_index(name);
+		if (m < 0) continue;
+		r->has_metric[m] = 1;
+		snprintf(r->metric[m], sizeof(r->metric[m]), "%s", value);
+	}
+	fclose(in);
+	return 1;
+}
+
+// Values may contain commas (start poses): quoted
+static void write_field(FILE *out, const char *value)
+{
+	if (strchr(value, ',') != NULL) fprintf(out, ",\"%s\"", value);
+	else fprintf(out, ",%s", value);
+}
+
+static void write_results(FILE *out, run_t *runs, int n_runs)
+{
+	static result_t results[MAX_RUNS];
+
+	for (int k = 0; k < n_runs; k++)
+		read_result(k, &results[k]);
+
+	fprintf(out, "run");
+	for (int i = 0; i < n_dims; i++) fprintf(out, ",%s", dims[i].name);
+	fprintf(out, ",status,laps,first_lap_s,best_lap_s,mean_lap_s");
+	for (int m = 0; m < n_metrics; m++) fprintf(out, ",%s", metric_names[m]);
+	fprintf(out, "\n");
+
+	for (int k = 0; k < n_runs; k++)
+	{
+		const char *values[MAX_DIMS];
+		result_t *r = &results[k];
+		run_values(k, values);
+
+		fprintf(out, "%d", k);
+		for (int i = 0; i < n_dims; i++) write_field(out, values[i]);
+		fprintf(out, ",%d,%d", runs[k].status, r->laps);
+		if (r->laps > 0)
+			fprintf(out, ",%.3f,%.3f,%.3f", r->first_lap, r->best_lap, r->total_lap / r->laps);
+		else
+			fprintf(out, ",,,");
+		for (int m = 0; m < n_metrics; m++)
+			fprintf(out, ",%s", r->has_metric[m] ? r->metric[m] : "");
+		fprintf(out, "\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static run_t runs[MAX_RUNS];
+	const char *results_path = "batch_results.csv";
+	int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:l:s:b:d:o:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'j': jobs = atoi(optarg); break;
+			case 'l': laps = atoi(optarg); break;
+			case 's': seconds = optarg; break;
+			case 'b': simulator = optarg; break;
+			case 'd': workdir = optarg; break;
+			case 'o': results_path = optarg; break;
+			default:
+				fprintf(stderr, "Usage: %s [-j jobs] [-l laps] [-s seconds] [-b simulator] [-d workdir] [-o results.csv] sweep.txt\n", argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1 || !read_sweep(argv[optind])) {
+		fprintf(stderr, "Usage: %s [-j jobs] [-l laps] [-s seconds] [-b simulator] [-d workdir] [-o results.csv] sweep.txt\n", argv[0]);
+		return 1;
+	}
+	if (jobs < 1) jobs = 1;
+
+	long n_runs = 1;
+	for (int i = 0; i < n_dims; i++)
+	{
+		n_runs *= dims[i].n_values;
+		if (n_runs > MAX_RUNS) {
+			fprintf(stderr, "More than %d runs\n", MAX_RUNS);
+			return 1;
+		}
+	}
+
+	if (mkdir(workdir, 0755) != 0 && errno != EEXIST) {
+		perror(workdir);
+		return 1;
+	}
+
+	// Keep up to jobs simulators running
+	int started = 0, running = 0, failed = 0;
+	while (started < n_runs || running > 0)
+	{
+		if (started < n_runs && running < jobs)
+		{
+			runs[started].status = -1;
+			runs[started].pid = start_run(started);
+			if (runs[started].pid < 0) failed++;
+			else running++;
+			started++;
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if (pid < 0) break;
+		running--;
+
+		for (int k = 0; k < started; k++)
+		{
+			if (runs[k].pid != pid) continue;
+			runs[k].status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+			if (runs[k].status != 0) failed++;
+			printf("run %d/%ld done (status %d)\n", k + 1, n_runs, runs[k].status);
+			break;
+		}
+	}
+
+	FILE *out = fopen(results_path, "w");
+	if (out == NULL) {
+		perror(results_path);
+		return 1;
+	}
+	write_results(out, runs, (int)n_runs);
+	fclose(out);
+
+	printf("%ld runs, %d failed or below the laps, results in %s\n", n_runs, failed, results_path);
+	return failed > 0;
+}